@@ -0,0 +1,43 @@
+# - Try to find libdeflate
+# Once done this will define
+#
+#  LIBDEFLATE_FOUND - system has libdeflate
+#  LIBDEFLATE_INCLUDE_DIR - the libdeflate include directory
+#  LIBDEFLATE_LIBRARIES - Link these to use libdeflate
+#
+
+if (UNIX)
+  find_package(PkgConfig)
+  if (PKG_CONFIG_FOUND)
+    pkg_check_modules(_LIBDEFLATE libdeflate)
+  endif (PKG_CONFIG_FOUND)
+endif (UNIX)
+
+find_path(LIBDEFLATE_INCLUDE_DIR
+    NAMES
+        libdeflate.h
+    PATHS
+        ${_LIBDEFLATE_INCLUDEDIR}
+)
+
+find_library(LIBDEFLATE_LIBRARY
+    NAMES
+        deflate
+    PATHS
+        ${_LIBDEFLATE_LIBDIR}
+)
+
+if (LIBDEFLATE_LIBRARY)
+    set(LIBDEFLATE_LIBRARIES
+        ${LIBDEFLATE_LIBRARIES}
+        ${LIBDEFLATE_LIBRARY}
+    )
+endif (LIBDEFLATE_LIBRARY)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LibDeflate
+                                  FOUND_VAR LIBDEFLATE_FOUND
+                                  REQUIRED_VARS LIBDEFLATE_INCLUDE_DIR LIBDEFLATE_LIBRARY LIBDEFLATE_LIBRARIES)
+
+# show the LIBDEFLATE_INCLUDE_DIR and LIBDEFLATE_LIBRARIES variables only in the advanced view
+mark_as_advanced(LIBDEFLATE_INCLUDE_DIR LIBDEFLATE_LIBRARY LIBDEFLATE_LIBRARIES)
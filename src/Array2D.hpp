@@ -26,12 +26,22 @@
 #include <memory>
 #include <cstdint>
 #include <algorithm>
+#include <type_traits>
+#include "BufferAllocator.hpp"
 
 namespace hdrmerge {
 
 template <typename T>
 class Array2D {
+    static_assert(std::is_trivially_destructible<T>::value, "Array2D elements are not constructed nor destroyed");
 public:
+    typedef BufferAllocator::Buffer<T> Buffer;
+
+    /// A buffer of n uninitialized elements, from the current BufferAllocator
+    static Buffer allocate(size_t n) {
+        return BufferAllocator::allocateBuffer<T>(n);
+    }
+
     Array2D(size_t w, size_t h) { resize(w, h); }
     Array2D() : Array2D(0, 0) {}
     Array2D(const Array2D<T> & copy) {
@@ -74,7 +84,7 @@ public:
         width = w;
         height = h;
         dx = dy = 0;
-        data.reset(new T[w*h]);
+        data = allocate(w*h);
         alignedData = data.get();
     }
 
@@ -157,7 +167,7 @@ public:
     }
 
 protected:
-    std::unique_ptr<T[]> data;
+    Buffer data;
     T * alignedData;
     size_t width, height;
     int dx, dy;
@@ -0,0 +1,148 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include "BlendMap.hpp"
+#include "Log.hpp"
+#include "SimdKernels.hpp"
+using namespace std;
+using namespace hdrmerge;
+
+
+// Based on The GIMP: app/paint-funcs/paint-funcs.c:fatten_region, with the inner loops
+// vectorized by the SimdKernels
+static Array2D<uint8_t> fattenMask(const Array2D<uint8_t> & mask, int radius) {
+    const SimdKernels & simd = SimdKernels::get();
+    Timer t("Fatten mask");
+    size_t width = mask.getWidth(), height = mask.getHeight();
+    Array2D<uint8_t> result(width, height);
+
+    int circArray[2 * radius + 1]; // holds the y coords of the filter's mask
+    // compute_border(circArray, radius)
+    for (int i = 0; i < radius * 2 + 1; i++) {
+        double tmp;
+        if (i > radius)
+            tmp = (i - radius) - 0.5;
+        else if (i < radius)
+            tmp = (radius - i) - 0.5;
+        else
+            tmp = 0.0;
+        circArray[i] = int(std::sqrt(radius*radius - tmp*tmp));
+    }
+    // offset the circ pointer by radius so the range of the array
+    //     is [-radius] to [radius]
+    int * circ = circArray + radius;
+
+    const uint8_t * bufArray[height + 2*radius];
+    for (int i = 0; i < radius; i++) {
+        bufArray[i] = &mask[0];
+    }
+    for (size_t i = 0; i < height; i++) {
+        bufArray[i + radius] = &mask[i * width];
+    }
+    for (int i = 0; i < radius; i++) {
+        bufArray[i + height + radius] = &mask[(height - 1) * width];
+    }
+    // offset the buf pointer
+    const uint8_t ** buf = bufArray + radius;
+
+    #pragma omp parallel
+    {
+        unique_ptr<uint8_t[]> buffer(new uint8_t[width * (radius + 1)]);
+        uint8_t *maxArray[radius+1]; // maxArray[i][x] is the maximum of column x in rows y - i to y + i
+        for (int i = 0; i <= radius; i++) {
+            maxArray[i] = &buffer[i*width];
+        }
+
+        #pragma omp for schedule(dynamic,16)
+        for (size_t y = 0; y < height; y++) {
+            size_t x = simd.fattenColumns(&buf[y], radius, maxArray, width);
+            for (; x < width; x++) { // compute max array, remaining columns
+                uint8_t lmax = buf[y][x];
+                if(radius<2) // max[0] is only used when radius < 2
+                    maxArray[0][x] = lmax;
+                for (int i = 1; i <= radius; i++) {
+                    lmax = std::max(std::max(lmax, buf[y + i][x]), buf[y - i][x]);
+                    maxArray[i][x] = lmax;
+                }
+            }
+
+            // render scan line, the columns closer than radius to the borders are not vectorized
+            auto renderColumn = [&] (size_t x) {
+                int minRadius = -std::min(radius, (int)x);
+                int maxRadius = std::min(radius, (int)(width - 1 - x));
+                uint8_t last_max = maxArray[circ[maxRadius]][x + maxRadius];
+                for (int i = maxRadius - 1; i >= minRadius; i--)
+                    last_max = std::max(last_max, maxArray[circ[i]][x + i]);
+                result(x, y) = last_max;
+            };
+            for (x = 0; x < width && (int)x < radius; x++) {
+                renderColumn(x);
+            }
+            for (x = simd.fattenRow(maxArray, circ, radius, &result(0, y), x, width); x < width; x++) {
+                renderColumn(x);
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/// Block maximum of the mask, so that the fattened low resolution mask covers the same pixels.
+/// With factor 1, it just unpacks the mask.
+static Array2D<uint8_t> decimateMask(const TiledMask & mask, int factor) {
+    size_t width = mask.getWidth(), height = mask.getHeight();
+    Array2D<uint8_t> result((width + factor - 1) / factor, (height + factor - 1) / factor);
+    #pragma omp parallel
+    {
+        unique_ptr<uint8_t[]> row(new uint8_t[width]);
+        #pragma omp for
+        for (size_t y = 0; y < result.getHeight(); ++y) {
+            uint8_t * dst = &result(0, y);
+            std::fill_n(dst, result.getWidth(), 0);
+            for (size_t ry = y * factor; ry < std::min((y + 1) * factor, height); ++ry) {
+                mask.getRow(ry, row.get());
+                for (size_t x = 0; x < width; ++x) {
+                    dst[x / factor] = std::max(dst[x / factor], row[x]);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+
+BlendMap::BlendMap(const TiledMask & mask, int radius, int f) : factor(f), width(mask.getWidth()),
+    map(fattenMask(decimateMask(mask, f), radius / f)) {
+    measureTime("Blur", [&] () {
+        map.blur(radius / factor);
+    });
+    if (factor > 1) {
+        // Pixel centers of the low resolution map, in image coordinates
+        x0.reset(new size_t[width]);
+        wx.reset(new float[width]);
+        for (size_t x = 0; x < width; ++x) {
+            sampleAt(x, map.getWidth(), x0[x], wx[x]);
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _BLENDMAP_HPP_
+#define _BLENDMAP_HPP_
+
+#include <algorithm>
+#include <memory>
+#include "BoxBlur.hpp"
+#include "TiledMask.hpp"
+
+namespace hdrmerge {
+
+/// The fattened and blurred mask, at 1/factor of the resolution of the image.
+/// Rows are bilinearly upsampled on demand.
+class BlendMap {
+public:
+    BlendMap(const TiledMask & mask, int radius, int f);
+
+    /// The blurred map is smooth at the scale of the radius, so it is computed at a lower
+    /// resolution that keeps at least samples pixels per radius. 0 samples means full resolution.
+    static int factorFor(int radius, int samples) {
+        return samples > 0 ? std::max(radius / samples, 1) : 1;
+    }
+
+    /// Returns row y of the map, upsampled into buffer if needed
+    const float * getRow(size_t y, float * buffer) const {
+        if (factor == 1) {
+            return &map(0, y);
+        }
+        size_t y0;
+        float wy;
+        sampleAt(y, map.getHeight(), y0, wy);
+        const float * top = &map(0, y0), * bottom = &map(0, std::min(y0 + 1, map.getHeight() - 1));
+        for (size_t x = 0; x < width; ++x) {
+            size_t x1 = x0[x] + 1 < map.getWidth() ? x0[x] + 1 : x0[x];
+            float t = top[x0[x]] + wx[x] * (top[x1] - top[x0[x]]);
+            float b = bottom[x0[x]] + wx[x] * (bottom[x1] - bottom[x0[x]]);
+            buffer[x] = t + wy * (b - t);
+        }
+        return buffer;
+    }
+
+private:
+    int factor;
+    size_t width;
+    BoxBlur map;
+    std::unique_ptr<size_t[]> x0;
+    std::unique_ptr<float[]> wx;
+
+    void sampleAt(size_t i, size_t size, size_t & i0, float & w) const {
+        float pos = (i + 0.5f) / factor - 0.5f;
+        if (pos <= 0.0f) {
+            i0 = 0;
+            w = 0.0f;
+        } else if (pos >= size - 1) {
+            i0 = size - 1;
+            w = 0.0f;
+        } else {
+            i0 = pos;
+            w = pos - i0;
+        }
+    }
+};
+
+} // namespace hdrmerge
+
+#endif // _BLENDMAP_HPP_
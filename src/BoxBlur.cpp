@@ -22,13 +22,20 @@
 
 #include <cmath>
 #include "BoxBlur.hpp"
+#include "TiledArray2D.hpp"
 
 namespace hdrmerge {
 
-void BoxBlur::blur(size_t radius) {
+const size_t BoxBlur::minTiledWidth;
+
+void BoxBlur::blur(size_t radius, Layout layout) {
     // From http://blog.ivank.net/fastest-gaussian-blur.html
-    tmp.reset(new float[width*height]);
     size_t hr = std::round(radius*0.39);
+    if (layout == TILES) {
+        blurTiles(hr);
+        return;
+    }
+    tmp = allocate(width*height);
     boxBlur(hr);
     boxBlur(hr);
     boxBlur(hr);
@@ -36,6 +43,85 @@ void BoxBlur::blur(size_t radius) {
 }
 
 
+// Running sum over a line of n values, clamped at both ends
+static void boxBlurLine(const float * src, float * dst, size_t n, size_t r) {
+    float iarr = 1.0 / (r+r+1);
+    size_t ti = 0, li = 0, ri = r;
+    float val = src[li] * (r + 1);
+    for (size_t j = 0; j < r; ++j) {
+        val += src[li + j];
+    }
+    for (size_t j = 0; j <= r; ++j) {
+        val += src[ri++] - src[li];
+        dst[ti++] = val*iarr;
+    }
+    for (size_t j = r + 1; j < n - r; ++j) {
+        val += src[ri++] - src[li++];
+        dst[ti++] = val*iarr;
+    }
+    for (size_t j = n - r; j < n; ++j) {
+        val += src[ri - 1] - src[li++];
+        dst[ti++] = val*iarr;
+    }
+}
+
+
+// Horizontal pass, row by row
+static void boxBlurTilesH(const TiledArray2D<float> & src, TiledArray2D<float> & dst, size_t r) {
+    size_t width = src.getWidth();
+    #pragma omp parallel
+    {
+        std::unique_ptr<float[]> in(new float[width]), out(new float[width]);
+        #pragma omp for schedule(static)
+        for (size_t y = 0; y < src.getHeight(); ++y) {
+            src.getRow(y, in.get());
+            boxBlurLine(in.get(), out.get(), width, r);
+            dst.setRow(y, out.get());
+        }
+    }
+}
+
+
+// Vertical pass, down each column of tiles with a running sum per column
+static void boxBlurTilesT(const TiledArray2D<float> & src, TiledArray2D<float> & dst, size_t r) {
+    const size_t numCols = TiledArray2D<float>::tileSize;
+    size_t height = src.getHeight();
+    float iarr = 1.0 / (r+r+1);
+    src.forEachTileColumn([&] (size_t tx) {
+        float val[numCols];
+        const float * first = src.tileRow(tx, 0);
+        for (size_t k = 0; k < numCols; ++k) {
+            val[k] = first[k] * (r + 1);
+        }
+        for (size_t j = 0; j < r; ++j) {
+            const float * row = src.tileRow(tx, j);
+            for (size_t k = 0; k < numCols; ++k) {
+                val[k] += row[k];
+            }
+        }
+        for (size_t y = 0; y < height; ++y) {
+            const float * add = src.tileRow(tx, std::min(y + r, height - 1));
+            const float * sub = src.tileRow(tx, y > r ? y - r - 1 : 0);
+            float * out = dst.tileRow(tx, y);
+            for (size_t k = 0; k < numCols; ++k) {
+                val[k] += add[k] - sub[k];
+                out[k] = val[k]*iarr;
+            }
+        }
+    });
+}
+
+
+void BoxBlur::blurTiles(size_t radius) {
+    TiledArray2D<float> src(*this), dst(width, height);
+    for (int i = 0; i < 3; ++i) {
+        boxBlurTilesH(src, dst, radius);
+        boxBlurTilesT(dst, src, radius);
+    }
+    src.copyTo(*this);
+}
+
+
 void BoxBlur::boxBlur(size_t radius) {
     boxBlurH(radius);
     data.swap(tmp);
@@ -46,7 +132,8 @@ void BoxBlur::boxBlur(size_t radius) {
 
 void BoxBlur::boxBlurH(size_t r) {
     float iarr = 1.0 / (r+r+1);
-    #pragma omp parallel for schedule(dynamic)
+    // Static row blocks match the pages each thread touched first in BufferAllocator
+    #pragma omp parallel for schedule(static)
     for (size_t i = 0; i < height; ++i) {
         size_t ti = i * width, li = ti, ri = ti + r;
         float val = data[li] * (r + 1);
@@ -30,14 +30,26 @@ namespace hdrmerge {
 
 class BoxBlur : public Array2D<float>{
 public:
+    enum Layout {
+        ROWS,  ///< Blur in place, with the vertical passes striding across rows
+        TILES, ///< Blur a TiledArray2D copy, with the vertical passes reading whole tiles
+    };
+
+    /// From this width on, the tiled layout pays for its conversions
+    static const size_t minTiledWidth = 8000;
+
     template <typename T> BoxBlur(const Array2D<T> & src) : Array2D<float>(src) {}
-    void blur(size_t radius);
+    void blur(size_t radius) {
+        blur(radius, width >= minTiledWidth ? TILES : ROWS);
+    }
+    void blur(size_t radius, Layout layout);
 
 private:
     void boxBlur(size_t radius);
     void boxBlurH(size_t radius);
     void boxBlurT(size_t radius);
-    std::unique_ptr<float[]> tmp;
+    void blurTiles(size_t radius);
+    Buffer tmp;
 };
 } // namespace hdrmerge
 
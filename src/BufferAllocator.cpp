@@ -0,0 +1,174 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "BufferAllocator.hpp"
+using namespace hdrmerge;
+using namespace std;
+
+const size_t BufferAllocator::alignment;
+const size_t BufferAllocator::hugePageSize;
+
+
+#ifdef __linux__
+// Large buffers are mapped directly, with a header that remembers the length of the mapping
+static const size_t mappedThreshold = BufferAllocator::hugePageSize;
+
+static void * mapBuffer(size_t bytes, BufferAllocator::HugePages policy, bool firstTouch) {
+    size_t length = bytes + BufferAllocator::alignment;
+    void * base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (policy == BufferAllocator::EXPLICIT) {
+        size_t hugeLength = (length + BufferAllocator::hugePageSize - 1) & ~(BufferAllocator::hugePageSize - 1);
+        base = mmap(nullptr, hugeLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            length = hugeLength;
+        }
+    }
+#endif
+    if (base == MAP_FAILED) {
+        base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (policy != BufferAllocator::NONE) {
+            madvise(base, length, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    if (firstTouch) {
+        char * pages = static_cast<char *>(base);
+        const size_t pageSize = 4096;
+        #pragma omp parallel for schedule(static)
+        for (size_t page = 0; page < (length + pageSize - 1) / pageSize; ++page) {
+            pages[page * pageSize] = 0;
+        }
+    }
+    *static_cast<size_t *>(base) = length;
+    return static_cast<char *>(base) + BufferAllocator::alignment;
+}
+
+
+static void unmapBuffer(void * p) {
+    void * base = static_cast<char *>(p) - BufferAllocator::alignment;
+    munmap(base, *static_cast<size_t *>(base));
+}
+#endif
+
+
+void * BufferAllocator::allocate(size_t bytes) {
+    if (bytes == 0) {
+        return nullptr;
+    }
+#ifdef __linux__
+    if (bytes >= mappedThreshold) {
+        return mapBuffer(bytes, hugePages(), firstTouch());
+    }
+#endif
+    void * p;
+#ifdef _WIN32
+    p = _aligned_malloc(bytes, alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+#else
+    if (posix_memalign(&p, alignment, bytes)) {
+        throw std::bad_alloc();
+    }
+#endif
+    return p;
+}
+
+
+void BufferAllocator::deallocate(void * p, size_t bytes) {
+    if (p == nullptr) {
+        return;
+    }
+#ifdef __linux__
+    if (bytes >= mappedThreshold) {
+        unmapBuffer(p);
+        return;
+    }
+#endif
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+
+static BufferAllocator & defaultAllocator() {
+    static BufferAllocator allocator;
+    return allocator;
+}
+
+
+BufferAllocator *& BufferAllocator::current() {
+    static BufferAllocator * allocator = &defaultAllocator();
+    return allocator;
+}
+
+
+void BufferAllocator::set(BufferAllocator * allocator) {
+    current() = allocator ? allocator : &defaultAllocator();
+}
+
+
+BufferAllocator::HugePages & BufferAllocator::hugePages() {
+    static HugePages policy = TRANSPARENT;
+    return policy;
+}
+
+
+bool & BufferAllocator::firstTouch() {
+    static bool enabled = false;
+    return enabled;
+}
+
+
+bool BufferAllocator::setHugePages(const string & name) {
+    for (HugePages h : {NONE, TRANSPARENT, EXPLICIT}) {
+        if (name == BufferAllocator::name(h)) {
+            hugePages() = h;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char * BufferAllocator::name(HugePages h) {
+    switch (h) {
+        case NONE: return "none";
+        case TRANSPARENT: return "transparent";
+        case EXPLICIT: return "explicit";
+    }
+    return "";
+}
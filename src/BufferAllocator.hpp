@@ -0,0 +1,97 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _BUFFERALLOCATOR_HPP_
+#define _BUFFERALLOCATOR_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace hdrmerge {
+
+/// Allocates the pixel buffers of Array2D. Buffers are aligned to a cache line, and
+/// large ones can be backed by huge pages to reduce TLB misses in full frame passes.
+/// A different allocator can be plugged in with set().
+class BufferAllocator {
+public:
+    enum HugePages {
+        NONE = 0,    ///< Regular pages
+        TRANSPARENT, ///< Ask the kernel for transparent huge pages, the default
+        EXPLICIT,    ///< Reserved huge pages, or regular ones if there are none left
+    };
+    static const size_t alignment = 64;
+    static const size_t hugePageSize = 2 << 20;
+
+    virtual ~BufferAllocator() {}
+    /// Returns a buffer of the given size aligned to alignment bytes, or nullptr for zero bytes
+    virtual void * allocate(size_t bytes);
+    /// Frees a buffer returned by allocate, with the same size
+    virtual void deallocate(void * p, size_t bytes);
+
+    /// Frees a buffer with the allocator that created it
+    template <typename T> struct Deleter {
+        BufferAllocator * allocator;
+        size_t bytes;
+        void operator()(T * p) const {
+            allocator->deallocate(p, bytes);
+        }
+    };
+    template <typename T> using Buffer = std::unique_ptr<T[], Deleter<T>>;
+    /// A buffer of n uninitialized elements, from the current allocator
+    template <typename T> static Buffer<T> allocateBuffer(size_t n) {
+        BufferAllocator & a = get();
+        return Buffer<T>(static_cast<T *>(a.allocate(n * sizeof(T))), Deleter<T>{&a, n * sizeof(T)});
+    }
+
+    /// The allocator of new buffers. Buffers are always freed by the allocator that created them.
+    static BufferAllocator & get() {
+        return *current();
+    }
+    /// Replaces the allocator, nullptr restores the default one. It must outlive its buffers.
+    static void set(BufferAllocator * allocator);
+
+    static HugePages getHugePages() {
+        return hugePages();
+    }
+    /// With first touch, the pages of new large buffers are touched by a parallel loop with
+    /// a static schedule, so that each one is placed in the NUMA node of the thread that
+    /// processes those rows in the static loops over the image.
+    static void setFirstTouch(bool enable) {
+        firstTouch() = enable;
+    }
+    static bool getFirstTouch() {
+        return firstTouch();
+    }
+    /// Sets the huge page policy by name; returns false if the name is unknown
+    static bool setHugePages(const std::string & name);
+    static const char * name(HugePages h);
+
+private:
+    static BufferAllocator *& current();
+    static HugePages & hugePages();
+    static bool & firstTouch();
+};
+
+} // namespace hdrmerge
+
+#endif // _BUFFERALLOCATOR_HPP_
@@ -0,0 +1,87 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BufferPool.hpp"
+using namespace hdrmerge;
+using namespace std;
+
+const size_t BufferPool::minPooledSize;
+
+
+BufferPool::~BufferPool() {
+    for (auto & sizeBuffers : freeBuffers) {
+        for (void * p : sizeBuffers.second) {
+            BufferAllocator::deallocate(p, sizeBuffers.first);
+        }
+    }
+}
+
+
+size_t BufferPool::sizeClass(size_t bytes) {
+    size_t step = 1;
+    while ((step << 4) <= bytes) {
+        step <<= 1;
+    }
+    return (bytes + step - 1) & ~(step - 1);
+}
+
+
+void * BufferPool::allocate(size_t bytes) {
+    if (bytes < minPooledSize) {
+        return BufferAllocator::allocate(bytes);
+    }
+    size_t size = sizeClass(bytes);
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = freeBuffers.find(size);
+        if (it != freeBuffers.end() && !it->second.empty()) {
+            void * p = it->second.back();
+            it->second.pop_back();
+            retained -= size;
+            ++hits;
+            return p;
+        }
+        ++misses;
+    }
+    return BufferAllocator::allocate(size);
+}
+
+
+void BufferPool::deallocate(void * p, size_t bytes) {
+    if (p == nullptr) {
+        return;
+    }
+    if (bytes < minPooledSize) {
+        BufferAllocator::deallocate(p, bytes);
+        return;
+    }
+    size_t size = sizeClass(bytes);
+    {
+        lock_guard<mutex> guard(lock);
+        if (retained + size <= maxRetained) {
+            freeBuffers[size].push_back(p);
+            retained += size;
+            return;
+        }
+    }
+    BufferAllocator::deallocate(p, size);
+}
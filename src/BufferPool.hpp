@@ -0,0 +1,67 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _BUFFERPOOL_HPP_
+#define _BUFFERPOOL_HPP_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include "BufferAllocator.hpp"
+
+namespace hdrmerge {
+
+/// Keeps the large buffers that are freed, to reuse them in the next allocations of a
+/// similar size instead of returning them to the system. Sizes are rounded up to classes
+/// that waste at most 1/8 of the buffer. Freed buffers that would exceed the cap are released.
+class BufferPool : public BufferAllocator {
+public:
+    static const size_t minPooledSize = 256 << 10;
+
+    explicit BufferPool(size_t maxRetainedBytes) : maxRetained(maxRetainedBytes), retained(0), hits(0), misses(0) {}
+    ~BufferPool();
+
+    void * allocate(size_t bytes) override;
+    void deallocate(void * p, size_t bytes) override;
+
+    size_t retainedBytes() const {
+        return retained;
+    }
+    size_t getHits() const {
+        return hits;
+    }
+    size_t getMisses() const {
+        return misses;
+    }
+
+private:
+    size_t maxRetained, retained;
+    size_t hits, misses;
+    std::map<size_t, std::vector<void *>> freeBuffers; ///< By size class
+    std::mutex lock;
+
+    static size_t sizeClass(size_t bytes);
+};
+
+} // namespace hdrmerge
+
+#endif // _BUFFERPOOL_HPP_
@@ -0,0 +1,92 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _CFALOOKUP_HPP_
+#define _CFALOOKUP_HPP_
+
+#include <cstdint>
+#include "RawParameters.hpp"
+
+namespace hdrmerge {
+
+/// Colour, black level and white multiplier of each position of a CFA pattern whose size is
+/// known at compile time. Kernels fetch one Row per image row and index it by column, instead
+/// of decoding the pattern per pixel. Coordinates are relative to the active area, and may be
+/// negative in the margins.
+template <int Rows, int Columns> class CFALookup {
+public:
+    static const int rows = Rows;
+    static const int columns = Columns;
+
+    struct Row {
+        uint8_t color[Columns];
+        uint16_t black[Columns];
+        float whiteMult[Columns];
+    };
+
+    explicit CFALookup(const RawParameters & params) {
+        for (int y = 0; y < Rows; ++y) {
+            for (int x = 0; x < Columns; ++x) {
+                uint8_t c = params.FC(x, y);
+                table[y].color[x] = c;
+                table[y].black[x] = params.cblack[c];
+                table[y].whiteMult[x] = params.camMul[c];
+            }
+        }
+    }
+
+    const Row & row(int y) const {
+        return table[wrap(y, Rows)];
+    }
+    /// Index of column x in a Row
+    static int column(int x) {
+        return wrap(x, Columns);
+    }
+
+private:
+    Row table[Rows];
+
+    static int wrap(int i, int n) {
+        int r = i % n;
+        return r < 0 ? r + n : r;
+    }
+};
+
+typedef CFALookup<2, 2> BayerLookup;
+typedef CFALookup<8, 2> Bayer8RowLookup;
+typedef CFALookup<6, 6> XTransLookup;
+
+/// Calls kernel with the CFALookup of the pattern of params. The kernel has a template call
+/// operator, so that its loops are compiled once for each pattern type.
+template <typename Kernel> void dispatchCFA(const RawParameters & params, Kernel && kernel) {
+    if (params.FC.getFilters() == 9) {
+        kernel(XTransLookup(params));
+    } else if (params.FC.getRows() == 2) {
+        kernel(BayerLookup(params));
+    } else {
+        kernel(Bayer8RowLookup(params));
+    }
+}
+
+} // namespace hdrmerge
+
+#endif // _CFALOOKUP_HPP_
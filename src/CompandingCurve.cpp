@@ -0,0 +1,50 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include "CompandingCurve.hpp"
+
+namespace hdrmerge {
+
+CompandingCurve::CompandingCurve() {
+    for (int code = 0; code <= knee; ++code) {
+        table.push_back(code);
+    }
+    double linear = knee;
+    for (int code = knee + 1; linear < 65535.0; ++code) {
+        linear = knee * std::exp((code - knee) / (double)knee);
+        table.push_back(linear < 65535.0 ? std::round(linear) : 65535);
+    }
+}
+
+
+uint16_t CompandingCurve::encode(float linear) const {
+    if (!(linear > 0.0f)) {
+        return 0;
+    } else if (linear < knee) {
+        return linear + 0.5f;
+    }
+    float code = knee + knee * std::log(linear / knee) + 0.5f;
+    return code < table.size() ? (uint16_t)code : table.size() - 1;
+}
+
+} // namespace hdrmerge
@@ -0,0 +1,54 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _COMPANDINGCURVE_HPP_
+#define _COMPANDINGCURVE_HPP_
+
+#include <cstdint>
+#include <vector>
+
+namespace hdrmerge {
+
+/// Maps linear values in [0, 65535] to 16-bit codes. Codes are the rounded value up to the
+/// knee, and logarithmic above it, with a step of 1/knee of the value. The table returned by
+/// linearization() decodes them, as the LinearizationTable of a DNG file.
+class CompandingCurve {
+public:
+    static const int knee = 2048;
+
+    CompandingCurve();
+
+    uint16_t encode(float linear) const;
+    uint16_t decode(uint16_t code) const {
+        return table[code];
+    }
+    const std::vector<uint16_t> & linearization() const {
+        return table;
+    }
+
+private:
+    std::vector<uint16_t> table;
+};
+
+} // namespace hdrmerge
+
+#endif // _COMPANDINGCURVE_HPP_
@@ -0,0 +1,223 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "CompressedFrame.hpp"
+using namespace std;
+using namespace hdrmerge;
+
+
+const size_t CompressedFrame::stripRows;
+
+namespace {
+
+// Samples packed with the same number of bits
+const size_t blockSize = 16;
+
+// Least recently used decoded strips of all the frames, by frame id and strip index
+class StripCache {
+public:
+    typedef shared_ptr<vector<uint16_t>> Strip;
+
+    StripCache() : capacity(0), used(0) {}
+
+    bool isEnabled() const {
+        return capacity > 0;
+    }
+    void setCapacity(size_t bytes) {
+        lock_guard<mutex> guard(lock);
+        capacity = bytes;
+        evict();
+    }
+    Strip get(uint64_t key) {
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(key);
+        if (it == index.end()) return Strip();
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+    void put(uint64_t key, const Strip & strip) {
+        lock_guard<mutex> guard(lock);
+        if (capacity == 0 || index.count(key)) return;
+        entries.emplace_front(key, strip);
+        index[key] = entries.begin();
+        used += strip->size() * sizeof(uint16_t);
+        evict();
+    }
+    void erase(uint64_t frame) {
+        lock_guard<mutex> guard(lock);
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->first >> 32 == frame) {
+                used -= it->second->size() * sizeof(uint16_t);
+                index.erase(it->first);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    atomic<size_t> capacity;
+    size_t used;
+    list<pair<uint64_t, Strip>> entries; ///< Most recently used first
+    unordered_map<uint64_t, list<pair<uint64_t, Strip>>::iterator> index;
+    mutex lock;
+
+    void evict() {
+        while (used > capacity && !entries.empty()) {
+            used -= entries.back().second->size() * sizeof(uint16_t);
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+};
+
+StripCache & cache() {
+    static StripCache stripCache;
+    return stripCache;
+}
+
+} // namespace
+
+
+CompressedFrame::CompressedFrame(const uint16_t * pixels, size_t w, size_t h)
+        : width(w), height(h), strips((h + stripRows - 1) / stripRows) {
+    static atomic<uint64_t> nextId(0);
+    id = nextId++;
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t s = 0; s < strips.size(); ++s) {
+        size_t y1 = std::min((s + 1) * stripRows, height);
+        for (size_t y = s * stripRows; y < y1; ++y) {
+            encodeRow(&pixels[y * width], width, strips[s]);
+        }
+        strips[s].shrink_to_fit();
+    }
+}
+
+
+CompressedFrame::~CompressedFrame() {
+    cache().erase(id);
+}
+
+
+void CompressedFrame::setCacheSize(size_t bytes) {
+    cache().setCapacity(bytes);
+}
+
+
+size_t CompressedFrame::memoryUsage() const {
+    size_t result = sizeof(*this) + strips.capacity() * sizeof(strips[0]);
+    for (auto & strip : strips) {
+        result += strip.capacity();
+    }
+    return result;
+}
+
+
+void CompressedFrame::encodeRow(const uint16_t * row, size_t width, vector<uint8_t> & dst) {
+    for (size_t x = 0; x < width; x += blockSize) {
+        size_t n = std::min(blockSize, width - x);
+        uint32_t residuals[blockSize], all = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int32_t prediction = x + i >= 2 ? row[x + i - 2] : 0;
+            int32_t d = row[x + i] - prediction;
+            residuals[i] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            all |= residuals[i];
+        }
+        int bits = 0;
+        while (all >> bits) ++bits;
+        dst.push_back(bits);
+        uint64_t acc = 0;
+        int accBits = 0;
+        for (size_t i = 0; i < n; ++i) {
+            acc |= (uint64_t)residuals[i] << accBits;
+            for (accBits += bits; accBits >= 8; accBits -= 8, acc >>= 8) {
+                dst.push_back(acc);
+            }
+        }
+        if (accBits > 0) {
+            dst.push_back(acc);
+        }
+    }
+}
+
+
+const uint8_t * CompressedFrame::decodeRow(const uint8_t * src, size_t width, uint16_t * row) {
+    for (size_t x = 0; x < width; x += blockSize) {
+        size_t n = std::min(blockSize, width - x);
+        int bits = *src++;
+        uint32_t mask = (1u << bits) - 1;
+        uint64_t acc = 0;
+        int accBits = 0;
+        for (size_t i = 0; i < n; ++i) {
+            for (; accBits < bits; accBits += 8) {
+                acc |= (uint64_t)*src++ << accBits;
+            }
+            uint32_t z = acc & mask;
+            acc >>= bits;
+            accBits -= bits;
+            int32_t prediction = x + i >= 2 ? row[x + i - 2] : 0;
+            row[x + i] = prediction + (int32_t)((z >> 1) ^ -(z & 1));
+        }
+    }
+    return src;
+}
+
+
+void CompressedFrame::decodeStrip(size_t s, uint16_t * dst) const {
+    const uint8_t * src = strips[s].data();
+    size_t rows = std::min((s + 1) * stripRows, height) - s * stripRows;
+    for (size_t y = 0; y < rows; ++y) {
+        src = decodeRow(src, width, &dst[y * width]);
+    }
+}
+
+
+void CompressedFrame::decodeRows(size_t first, size_t count, uint16_t * dst) const {
+    for (size_t s = first / stripRows; s * stripRows < first + count; ++s) {
+        size_t y0 = s * stripRows, y1 = std::min(y0 + stripRows, height);
+        size_t from = std::max(y0, first), to = std::min(y1, first + count);
+        uint16_t * out = &dst[(from - first) * width];
+        uint64_t key = id << 32 | s;
+        StripCache::Strip strip = cache().get(key);
+        if (!strip && cache().isEnabled()) {
+            strip = make_shared<vector<uint16_t>>((y1 - y0) * width);
+            decodeStrip(s, strip->data());
+            cache().put(key, strip);
+        }
+        if (strip) {
+            std::copy(strip->begin() + (from - y0) * width, strip->begin() + (to - y0) * width, out);
+        } else if (from == y0 && to == y1) {
+            decodeStrip(s, out);
+        } else {
+            vector<uint16_t> tmp((y1 - y0) * width);
+            decodeStrip(s, tmp.data());
+            std::copy(tmp.begin() + (from - y0) * width, tmp.begin() + (to - y0) * width, out);
+        }
+    }
+}
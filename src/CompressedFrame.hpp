@@ -0,0 +1,70 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _COMPRESSEDFRAME_HPP_
+#define _COMPRESSEDFRAME_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hdrmerge {
+
+/// A lossless copy of a frame, compressed by strips of stripRows rows. Each sample is coded as
+/// its difference with the one two columns to the left, of the same color in Bayer sensors, and
+/// the differences are packed in blocks of 16 with the bits of the largest one. Decoded strips
+/// are kept in a cache shared by all the frames, whose size trades memory for decoding time.
+class CompressedFrame {
+public:
+    static const size_t stripRows = 16;
+
+    CompressedFrame(const uint16_t * pixels, size_t w, size_t h);
+    ~CompressedFrame();
+    CompressedFrame(const CompressedFrame &) = delete;
+    CompressedFrame & operator=(const CompressedFrame &) = delete;
+
+    size_t getWidth() const {
+        return width;
+    }
+    size_t getHeight() const {
+        return height;
+    }
+    /// Decodes count rows from first on into dst, which holds getWidth() samples per row
+    void decodeRows(size_t first, size_t count, uint16_t * dst) const;
+    size_t memoryUsage() const;
+
+    /// Sets the memory kept by the cache of decoded strips, 0 disables it
+    static void setCacheSize(size_t bytes);
+
+private:
+    size_t width, height;
+    uint64_t id; ///< Identifies the strips of this frame in the cache
+    std::vector<std::vector<uint8_t>> strips;
+
+    static void encodeRow(const uint16_t * row, size_t width, std::vector<uint8_t> & dst);
+    static const uint8_t * decodeRow(const uint8_t * src, size_t width, uint16_t * row);
+    void decodeStrip(size_t s, uint16_t * dst) const;
+};
+
+} // namespace hdrmerge
+
+#endif // _COMPRESSEDFRAME_HPP_
@@ -0,0 +1,74 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "CpuFeatures.hpp"
+#include "Log.hpp"
+using namespace hdrmerge;
+
+
+CpuFeatures::CpuFeatures() : detectedLevel(GENERIC) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        detectedLevel = SSE2;
+    }
+#ifdef HAVE_AVX2_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        detectedLevel = AVX2;
+    }
+#endif
+#ifdef HAVE_AVX512_KERNELS
+    if (detectedLevel == AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        detectedLevel = AVX512;
+    }
+#endif
+#elif defined(__SSE2__)
+    detectedLevel = SSE2;
+#endif
+    currentLevel = detectedLevel;
+}
+
+
+bool CpuFeatures::setMaximum(const std::string & levelName) {
+    CpuFeatures & f = getInstance();
+    for (int l = GENERIC; l <= AVX512; ++l) {
+        if (levelName == name((Level)l)) {
+            f.currentLevel = l > f.detectedLevel ? f.detectedLevel : (Level)l;
+            if (l > f.detectedLevel) {
+                Log::progress(levelName, " kernels are not available, using ", name(f.currentLevel));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char * CpuFeatures::name(Level l) {
+    switch (l) {
+        case SSE2: return "sse2";
+        case AVX2: return "avx2";
+        case AVX512: return "avx512";
+        default: return "generic";
+    }
+}
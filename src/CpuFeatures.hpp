@@ -0,0 +1,65 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _CPUFEATURES_HPP_
+#define _CPUFEATURES_HPP_
+
+#include <string>
+
+namespace hdrmerge {
+
+/// Instruction set used by the SIMD kernels. It is detected from CPUID at startup,
+/// and can be lowered from the command line to test or compare the kernels.
+class CpuFeatures {
+public:
+    enum Level {
+        GENERIC = 0,
+        SSE2,
+        AVX2,
+        AVX512,
+    };
+
+    static Level detected() {
+        return getInstance().detectedLevel;
+    }
+    static Level current() {
+        return getInstance().currentLevel;
+    }
+    /// Limits the kernels to those of the named level; returns false if the name is unknown.
+    /// Levels that the CPU does not support are lowered to the detected one.
+    static bool setMaximum(const std::string & name);
+    static const char * name(Level l);
+
+private:
+    Level detectedLevel, currentLevel;
+
+    CpuFeatures();
+
+    static CpuFeatures & getInstance() {
+        static CpuFeatures instance;
+        return instance;
+    }
+};
+
+} // namespace hdrmerge
+
+#endif // _CPUFEATURES_HPP_
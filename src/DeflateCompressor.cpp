@@ -0,0 +1,77 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <zlib.h>
+// Before libdeflate.h, it includes the config.h that defines HAVE_LIBDEFLATE
+#include "DeflateCompressor.hpp"
+#ifdef HAVE_LIBDEFLATE
+    #include <libdeflate.h>
+#endif
+using namespace hdrmerge;
+
+
+DeflateCompressor::DeflateCompressor(int l) : level(l) {
+    if (level < minLevel) level = minLevel;
+    if (level > maxLevel) level = maxLevel;
+#ifdef HAVE_LIBDEFLATE
+    compressor = libdeflate_alloc_compressor(level);
+#endif
+}
+
+
+DeflateCompressor::~DeflateCompressor() {
+#ifdef HAVE_LIBDEFLATE
+    if (compressor) {
+        libdeflate_free_compressor(compressor);
+    }
+#endif
+}
+
+
+size_t DeflateCompressor::bound(size_t srcLen) {
+#ifdef HAVE_LIBDEFLATE
+    return libdeflate_zlib_compress_bound(nullptr, srcLen);
+#else
+    return compressBound(srcLen);
+#endif
+}
+
+
+size_t DeflateCompressor::compress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstLen) {
+#ifdef HAVE_LIBDEFLATE
+    if (compressor) {
+        return libdeflate_zlib_compress(compressor, src, srcLen, dst, dstLen);
+    }
+#endif
+    uLongf compressedLength = dstLen;
+    int err = compress2(dst, &compressedLength, src, srcLen, level);
+    return err == Z_OK ? compressedLength : 0;
+}
+
+
+const char * DeflateCompressor::backendName() {
+#ifdef HAVE_LIBDEFLATE
+    return "libdeflate";
+#else
+    return "zlib";
+#endif
+}
@@ -0,0 +1,65 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _DEFLATECOMPRESSOR_HPP_
+#define _DEFLATECOMPRESSOR_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include "config.h"
+
+#ifdef HAVE_LIBDEFLATE
+struct libdeflate_compressor;
+#endif
+
+namespace hdrmerge {
+
+/// Compresses buffers into zlib streams, as TIFF Deflate compression expects.
+/// It uses libdeflate when available, zlib otherwise. Objects are not thread-safe,
+/// use one per thread.
+class DeflateCompressor {
+public:
+    static const int minLevel = 0;
+    static const int maxLevel = 9;
+    static const int defaultLevel = 6;
+
+    DeflateCompressor(int level = defaultLevel);
+    ~DeflateCompressor();
+    DeflateCompressor(const DeflateCompressor & copy) = delete;
+    DeflateCompressor & operator=(const DeflateCompressor & copy) = delete;
+
+    /// Worst case compressed size of a buffer of srcLen bytes
+    static size_t bound(size_t srcLen);
+    /// Returns the compressed size, or 0 if compression failed
+    size_t compress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstLen);
+    static const char * backendName();
+
+private:
+    int level;
+#ifdef HAVE_LIBDEFLATE
+    libdeflate_compressor * compressor;
+#endif
+};
+
+} // namespace hdrmerge
+
+#endif // _DEFLATECOMPRESSOR_HPP_
@@ -22,19 +22,20 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
+#include <future>
 #include <QBuffer>
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QFile>
 #include <QImageWriter>
-#include <zlib.h>
-#ifdef __SSE2__
-    #include <x86intrin.h>
-#endif
 
 #include "config.h"
 #include "DngFloatWriter.hpp"
+#include "FloatTileEncoder.hpp"
 #include "RawParameters.hpp"
+#include "Threads.hpp"
 #include "Log.hpp"
-#include "ExifTransfer.hpp"
 using namespace std;
 
 
@@ -75,6 +76,7 @@ enum {
     BLACKLEVELREP = 50713,
     BLACKLEVEL = 50714,
     WHITELEVEL = 50717,
+    LINEARIZATIONTABLE = 50712,
     CFAPATTERNDIM = 33421,
     CFAPATTERN = 33422,
     CFAPLANECOLOR = 50710,
@@ -84,6 +86,8 @@ enum {
     CAMERANEUTRAL = 50728,
     ORIENTATION = 274,
     UNIQUENAME = 50708,
+    RAWDATAUNIQUEID = 50781,
+    NEWRAWIMAGEDIGEST = 51111,
     SUBIFDS = 330,
 
     TIFFEPSTD = 37398,
@@ -113,23 +117,64 @@ enum {
     TIFF_DEFLATE = 8,
     TIFF_JPEG = 7,
     TIFF_FP2XPREDICTOR = 34894,
+    TIFF_X2PREDICTOR = 34892,
     TIFF_FPFORMAT = 3,
+    TIFF_UINTFORMAT = 1,
     TIFF_CFA = 32803,
     TIFF_YCBCR = 6,
 };
 
 
+// Black level of the integer samples, so that the noise below the black level of the camera is kept
+static const int integerBlackLevel = 256;
+
+
 void DngFloatWriter::write(Array2D<float> && rawPixels, const RawParameters & p, const QString & dstFileName) {
     params = &p;
     rawData = std::move(rawPixels);
     width = rawData.getWidth();
     height = rawData.getHeight();
+    if (integerSamples) {
+        bps = 16;
+        integerScale = (65535 - integerBlackLevel) / (float)std::max(params->max - params->maxBlack, 1);
+    }
+    writeFile(dstFileName);
+    rawData = Array2D<float>();
+}
+
+
+void DngFloatWriter::write(Array2D<HalfFloat> && rawPixels, const RawParameters & p, const QString & dstFileName) {
+    params = &p;
+    halfData = std::move(rawPixels);
+    width = halfData.getWidth();
+    height = halfData.getHeight();
+    bps = 16;
+    integerSamples = false;
+    writeFile(dstFileName);
+    halfData = Array2D<HalfFloat>();
+}
+
 
-    renderPreviews();
+void DngFloatWriter::writeFile(const QString & dstFileName) {
+    if (!hasMetadata) {
+        metadata = Exif::Metadata(params->fileName);
+    }
+    // The JPEG preview is encoded while the tiles are compressed, the file is laid out when both are done
+    std::future<void> jpegPreview = std::async(std::launch::async, [this] () {
+        Threads::unpin();
+        renderPreviews();
+    });
+    calculateTiles();
+    compressTiles();
+    jpegPreview.get();
 
+    // The metadata stream goes first, its offsets are relative to the beginning of the file
+    const std::vector<uint8_t> & metadataStream = metadata.data();
+    size_t mainIFDoffset = metadataStream.empty() ? 8 : (metadataStream.size() + 1) & ~(size_t)1;
     createMainIFD();
-    subIFDoffsets[0] = 8 + mainIFD.length();
     createRawIFD();
+    metadata.addTo(mainIFD, rawIFD);
+    subIFDoffsets[0] = mainIFDoffset + mainIFD.length();
     size_t dataOffset = subIFDoffsets[0] + rawIFD.length();
     if (previewWidth > 0) {
         createPreviewIFD();
@@ -139,21 +184,29 @@ void DngFloatWriter::write(Array2D<float> && rawPixels, const RawParameters & p,
     mainIFD.setValue(SUBIFDS, (const void *)subIFDoffsets);
     pos = dataOffset;
     size_t dataSize = dataOffset + thumbSize() + previewSize() + rawSize();
-    fileData.reset(new uint8_t[dataSize]);
+    fileData = BufferAllocator::allocateBuffer<uint8_t>(dataSize);
 
     Timer t("Write output");
     writePreviews();
     writeRawData();
     dataSize = pos;
+    std::fill_n(std::copy(metadataStream.begin(), metadataStream.end(), fileData.get()),
+                mainIFDoffset - metadataStream.size(), 0);
     pos = 0;
-    TiffHeader().write(fileData.get(), pos);
+    TiffHeader header;
+    header.offset = mainIFDoffset;
+    header.write(fileData.get(), pos);
+    pos = mainIFDoffset;
     mainIFD.write(fileData.get(), pos, false);
     rawIFD.write(fileData.get(), pos, false);
     if (previewWidth > 0) {
         previewIFD.write(fileData.get(), pos, false);
     }
 
-    Exif::transfer(p.fileName, dstFileName, fileData.get(), dataSize);
+    QFile file(dstFileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write((const char *)fileData.get(), dataSize) != (qint64)dataSize) {
+        Log::progress("Cannot write ", dstFileName, ": ", file.errorString());
+    }
 }
 
 
@@ -173,6 +226,11 @@ void DngFloatWriter::createMainIFD() {
     mainIFD.addEntry(COPYRIGHT, "");
     mainIFD.addEntry(IMAGEDESCRIPTION, params->description);
     QDateTime currentTime = QDateTime::currentDateTime();
+    // Honor SOURCE_DATE_EPOCH, so that the output can be reproduced byte by byte
+    const char * sourceDateEpoch = getenv("SOURCE_DATE_EPOCH");
+    if (sourceDateEpoch) {
+        currentTime = QDateTime::fromTime_t(strtoul(sourceDateEpoch, nullptr, 10), Qt::UTC);
+    }
     QString currentTimeText = currentTime.toString("yyyy:MM:dd hh:mm:ss");
     mainIFD.addEntry(DATETIME, currentTimeText.toLatin1().constData());
     mainIFD.addEntry(DATETIMEORIGINAL, params->dateTime);
@@ -202,7 +260,13 @@ void DngFloatWriter::createMainIFD() {
     mainIFD.addEntry(CAMERANEUTRAL, IFD::RATIONAL, params->colors, cameraNeutral);
     mainIFD.addEntry(ORIENTATION, IFD::SHORT, params->tiffOrientation);
     mainIFD.addEntry(UNIQUENAME, params->maker + " " + params->model);
-    // TODO: Add Digest and Unique ID
+    mainIFD.addEntry(NEWRAWIMAGEDIGEST, IFD::BYTE, 16, rawImageDigest.constData());
+    // Identify the raw data by the camera and its digest, so that it is reproducible
+    QCryptographicHash uniqueID(QCryptographicHash::Md5);
+    uniqueID.addData(params->maker.c_str(), params->maker.length());
+    uniqueID.addData(params->model.c_str(), params->model.length());
+    uniqueID.addData(rawImageDigest);
+    mainIFD.addEntry(RAWDATAUNIQUEID, IFD::BYTE, 16, uniqueID.result().constData());
     mainIFD.addEntry(SUBIFDS, IFD::LONG, previewWidth > 0 ? 2 : 1, subIFDoffsets);
 
     // Thumbnail
@@ -223,7 +287,16 @@ void DngFloatWriter::createMainIFD() {
 
 void DngFloatWriter::calculateTiles() {
     int bytesPerTile = 512 * 1024;
-    int cellSize = 16;
+    uint32_t cellSize = 16;
+    if (requestedTileWidth > 0 && requestedTileLength > 0) {
+        tileWidth = std::min(requestedTileWidth, width);
+        tileWidth = ((tileWidth + cellSize - 1) / cellSize) * cellSize;
+        tilesAcross = (width + tileWidth - 1) / tileWidth;
+        tileLength = std::min(requestedTileLength, height);
+        tileLength = ((tileLength + cellSize - 1) / cellSize) * cellSize;
+        tilesDown = (height + tileLength - 1) / tileLength;
+        return;
+    }
     uint32_t bytesPerSample = bps >> 3;
     uint32_t samplesPerTile = bytesPerTile / bytesPerSample;
     uint32_t tileSide = std::round(std::sqrt(samplesPerTile));
@@ -242,7 +315,7 @@ void DngFloatWriter::createRawIFD() {
     uint16_t cfaRows = params->FC.getRows(), cfaCols = params->FC.getColumns();
     uint16_t cfaPatternDim[] = { cfaRows, cfaCols };
 
-    rawIFD.addEntry(NEWSUBFILETYPE, IFD::LONG, 0x10001); // Fix it later in ExifTransfer.cpp
+    rawIFD.addEntry(NEWSUBFILETYPE, IFD::LONG, 0);
     rawIFD.addEntry(IMAGEWIDTH, IFD::LONG, width);
     rawIFD.addEntry(IMAGELENGTH, IFD::LONG, height);
 
@@ -263,11 +336,11 @@ void DngFloatWriter::createRawIFD() {
     uint16_t cblack[cfaRows * cfaCols];
     for (int row = 0; row < cfaRows; ++row) {
         for (int col = 0; col < cfaCols; ++col) {
-            cblack[row*cfaCols + col] = params->blackAt(col, row);
+            cblack[row*cfaCols + col] = integerSamples ? integerBlackLevel : params->blackAt(col, row);
         }
     }
     rawIFD.addEntry(BLACKLEVEL, IFD::SHORT, cfaRows * cfaCols, cblack);
-    rawIFD.addEntry(WHITELEVEL, IFD::SHORT, params->max);
+    rawIFD.addEntry(WHITELEVEL, IFD::SHORT, integerSamples ? 65535 : params->max);
     rawIFD.addEntry(SAMPLESPERPIXEL, IFD::SHORT, 1);
     rawIFD.addEntry(BITSPERSAMPLE, IFD::SHORT, bps);
     if (bps == 24) {
@@ -275,16 +348,23 @@ void DngFloatWriter::createRawIFD() {
     }
     rawIFD.addEntry(PLANARCONFIG, IFD::SHORT, 1);
     rawIFD.addEntry(COMPRESSION, IFD::SHORT, TIFF_DEFLATE);
-    rawIFD.addEntry(PREDICTOR, IFD::SHORT, TIFF_FP2XPREDICTOR);
-    rawIFD.addEntry(SAMPLEFORMAT, IFD::SHORT, TIFF_FPFORMAT);
+    if (integerSamples) {
+        rawIFD.addEntry(PREDICTOR, IFD::SHORT, TIFF_X2PREDICTOR);
+        rawIFD.addEntry(SAMPLEFORMAT, IFD::SHORT, TIFF_UINTFORMAT);
+        const std::vector<uint16_t> & table = curve.linearization();
+        rawIFD.addEntry(LINEARIZATIONTABLE, IFD::SHORT, table.size(), table.data());
+    } else {
+        rawIFD.addEntry(PREDICTOR, IFD::SHORT, TIFF_FP2XPREDICTOR);
+        rawIFD.addEntry(SAMPLEFORMAT, IFD::SHORT, TIFF_FPFORMAT);
+    }
 
-    calculateTiles();
     uint32_t numTiles = tilesAcross * tilesDown;
-    uint32_t buffer[numTiles];
+    // Placeholders, writeRawData sets the values. Small tiles of large frames make too many for the stack
+    std::vector<uint32_t> buffer(numTiles);
     rawIFD.addEntry(TILEWIDTH, IFD::LONG, tileWidth);
     rawIFD.addEntry(TILELENGTH, IFD::LONG, tileLength);
-    rawIFD.addEntry(TILEOFFSETS, IFD::LONG, numTiles, buffer);
-    rawIFD.addEntry(TILEBYTES, IFD::LONG, numTiles, buffer);
+    rawIFD.addEntry(TILEOFFSETS, IFD::LONG, numTiles, buffer.data());
+    rawIFD.addEntry(TILEBYTES, IFD::LONG, numTiles, buffer.data());
 
     rawIFD.addEntry(PHOTOINTERPRETATION, IFD::SHORT, TIFF_CFA);
     rawIFD.addEntry(CFAPATTERNDIM, IFD::SHORT, 2, cfaPatternDim);
@@ -343,13 +423,43 @@ void DngFloatWriter::renderPreviews() {
 }
 
 
+// Averages each 2x2 block of an RGB32 image
+static QImage halveImage(const QImage & src) {
+    QImage dst(src.width() / 2, src.height() / 2, QImage::Format_RGB32);
+    const uchar * srcBits = src.constBits();
+    uchar * dstBits = dst.bits();
+    int srcLine = src.bytesPerLine(), dstLine = dst.bytesPerLine(), w = dst.width(), h = dst.height();
+    #pragma omp parallel for schedule(dynamic,16)
+    for (int y = 0; y < h; ++y) {
+        const QRgb * r0 = (const QRgb *)(srcBits + 2*y*srcLine);
+        const QRgb * r1 = (const QRgb *)(srcBits + (2*y + 1)*srcLine);
+        QRgb * d = (QRgb *)(dstBits + y*dstLine);
+        for (int x = 0; x < w; ++x) {
+            QRgb a = r0[2*x], b = r0[2*x + 1], c = r1[2*x], e = r1[2*x + 1];
+            d[x] = qRgb((qRed(a) + qRed(b) + qRed(c) + qRed(e) + 2) >> 2,
+                        (qGreen(a) + qGreen(b) + qGreen(c) + qGreen(e) + 2) >> 2,
+                        (qBlue(a) + qBlue(b) + qBlue(c) + qBlue(e) + 2) >> 2);
+        }
+    }
+    return dst;
+}
+
+
 void DngFloatWriter::setPreview(const QImage & p) {
-    thumbnail = p.scaledToWidth(256, Qt::SmoothTransformation).convertToFormat(QImage::Format_RGB888);
-    if (previewWidth != p.width()) {
-        preview = p.scaledToWidth(previewWidth, Qt::SmoothTransformation);
-    } else {
-        preview = p;
+    Timer t("Scale previews");
+    // Halve the image until it is close to each target width, so that the final smooth
+    // scaling is cheap, and derive the thumbnail from the level of the preview
+    QImage level = p.convertToFormat(QImage::Format_RGB32);
+    if (previewWidth > 0) {
+        while (level.width() >= 2 * (int)previewWidth) {
+            level = halveImage(level);
+        }
+        preview = level.width() == (int)previewWidth ? level : level.scaledToWidth(previewWidth, Qt::SmoothTransformation);
     }
+    while (level.width() >= 2 * thumbnailWidth) {
+        level = halveImage(level);
+    }
+    thumbnail = level.scaledToWidth(thumbnailWidth, Qt::SmoothTransformation).convertToFormat(QImage::Format_RGB888);
 }
 
 
@@ -377,184 +487,164 @@ void DngFloatWriter::writePreviews() {
 }
 
 
-static void encodeFPDeltaRow(Bytef * src, Bytef * dst, size_t tileWidth, size_t realTileWidth, int bytesps, int factor) {
-    // Reorder bytes into the image
-    // 16 and 32-bit versions depend on local architecture, 24-bit does not
-    if (bytesps == 3) {
-        for (size_t col = 0; col < tileWidth; ++col) {
-            dst[col] = src[col*3];
-            dst[col + realTileWidth] = src[col*3 + 1];
-            dst[col + realTileWidth*2] = src[col*3 + 2];
-        }
-    } else {
-        for (size_t col = 0; col < tileWidth; ++col) {
-            for (int byte = 0; byte < bytesps; ++byte)
-#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-                dst[col + realTileWidth*(bytesps-byte-1)] = src[col*bytesps + byte];
-#else
-                dst[col + realTileWidth*byte] = src[col*bytesps + byte];
-#endif
-        }
-    }
-    // EncodeDeltaBytes
-    for (int col = realTileWidth*bytesps - 1; col >= factor; --col) {
-        dst[col] -= dst[col - factor];
+size_t DngFloatWriter::rawSize() {
+    size_t size = 0;
+    for (uint32_t bytes : tileBytes) {
+        size += bytes;
     }
+    return size;
 }
 
 
-// From DNG SDK dng_utils.h
-inline uint16_t DNG_FloatToHalf(uint32_t i) {
-    int32_t sign     =  (i >> 16) & 0x00008000;
-    int32_t exponent = ((i >> 23) & 0x000000ff) - (127 - 15);
-    int32_t mantissa =   i            & 0x007fffff;
-    if (exponent <= 0) {
-        if (exponent < -10) {
-            return (uint16_t)sign;
-        }
-        mantissa = (mantissa | 0x00800000) >> (1 - exponent);
-        if (mantissa &  0x00001000)
-            mantissa += 0x00002000;
-        return (uint16_t)(sign | (mantissa >> 13));
-    } else if (exponent == 0xff - (127 - 15)) {
-        if (mantissa == 0) {
-            return (uint16_t)(sign | 0x7c00);
-        } else {
-            return (uint16_t)(sign | 0x7c00 | (mantissa >> 13));
-        }
+// Adds a row of integer samples to a digest, stored as little endian
+static void hashRow(QCryptographicHash & hash, const uint16_t * src, size_t width, uint8_t * buffer) {
+    for (size_t x = 0; x < width; ++x) {
+        buffer[2*x] = src[x];
+        buffer[2*x + 1] = src[x] >> 8;
     }
-    if (mantissa & 0x00001000) {
-        mantissa += 0x00002000;
-        if (mantissa & 0x00800000) {
-            mantissa =  0;          // overflow in significand,
-            exponent += 1;          // adjust exponent
-        }
-    }
-    if (exponent > 30) {
-        return (uint16_t)(sign | 0x7c00); // infinity with the same sign as f.
-    }
-    return (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+    hash.addData((const char *)buffer, width * 2);
 }
 
 
-inline void DNG_FloatToFP24(uint32_t input, uint8_t *output) {
-    int32_t exponent = (int32_t) ((input >> 23) & 0xFF) - 128;
-    int32_t mantissa = input & 0x007FFFFF;
-    if (exponent == 127) {
-        if (mantissa != 0x007FFFFF && ((mantissa >> 7) == 0xFFFF)) {
-            mantissa &= 0x003FFFFF;         // knock out msb to make it a NaN
-        }
-    } else if (exponent > 63) {
-        exponent = 63;
-        mantissa = 0x007FFFFF;
-    } else if (exponent <= -64) {
-        if (exponent >= -79) {
-            mantissa = (mantissa | 0x00800000) >> (-63 - exponent);
+// Adds a row of samples to a digest, stored as little endian 16, 24 or 32 bit floats
+static void hashRow(QCryptographicHash & hash, const float * src, size_t width, int bytesps, uint8_t * buffer) {
+    const uint32_t * bits = (const uint32_t *)src;
+    uint8_t * dst = buffer;
+    for (size_t x = 0; x < width; ++x) {
+        if (bytesps == 2) {
+            uint16_t half = DNG_FloatToHalf(bits[x]);
+            *dst++ = half;
+            *dst++ = half >> 8;
+        } else if (bytesps == 3) {
+            DNG_FloatToFP24(bits[x], dst);
+            dst += 3;
         } else {
-            mantissa = 0;
+            for (int b = 0; b < 32; b += 8) {
+                *dst++ = bits[x] >> b;
+            }
         }
-        exponent = -64;
     }
-    output [0] = (uint8_t)(((input >> 24) & 0x80) | (uint32_t) (exponent + 64));
-    output [1] = (mantissa >> 15) & 0x00FF;
-    output [2] = (mantissa >>  7) & 0x00FF;
+    hash.addData((const char *)buffer, dst - buffer);
 }
 
 
-static void compressFloats(Bytef * dst, int tileWidth, int bytesps) {
-    if (bytesps == 2) {
-        uint16_t * dst16 = (uint16_t *) dst;
-#ifndef __F16C__
-        uint32_t * dst32 = (uint32_t *) dst;
-        for (int i = 0; i < tileWidth; ++i) {
-            dst16[i] = DNG_FloatToHalf(dst32[i]);
-        }
-#else
-        float * dst32 = (float *) dst;
-        int i = 0;
-        for (; i < tileWidth - 7; i += 8) {
-            __m128 singleFloat1 = _mm_loadu_ps(&dst32[i]);
-            __m128i halfFloat1 = _mm_cvtps_ph(singleFloat1, 0);
-            __m128 singleFloat2 = _mm_loadu_ps(&dst32[i + 4]);
-            __m128i halfFloat2 = _mm_cvtps_ph(singleFloat2, 0);
-            _mm_storeu_si128((__m128i*)&dst16[i], (__m128i)_mm_shuffle_ps((__m128)halfFloat1, (__m128)halfFloat2, _MM_SHUFFLE(1, 0, 1, 0)));
-        }
-        for (; i < tileWidth - 3; i += 4) {
-            __m128 singleFloat1 = _mm_loadu_ps(&dst32[i]);
-            __m128i halfFloat1 = _mm_cvtps_ph(singleFloat1, 0);
-            _mm_storeu_si128((__m128i*)&dst16[i], halfFloat1);
-        }
-        for (; i < tileWidth; ++i) {
-            dst16[i] = _cvtss_sh(dst32[i], 0);
-        }
-
-#endif
-    } else if (bytesps == 3) {
-        uint8_t  * dst8  = (uint8_t *)  dst;
-        uint32_t * dst32 = (uint32_t *) dst;
-        for (int i = 0; i < tileWidth; ++i) {
-            DNG_FloatToFP24(dst32[i], dst8);
-            dst8 += 3;
-        }
+void DngFloatWriter::encodeIntegerRow(size_t x, size_t y, size_t width, uint16_t * dst) const {
+    const float * src = &rawData(x, y);
+    for (size_t i = 0; i < width; ++i) {
+        float black = params->blackAt(x + i - params->leftMargin, y - params->topMargin);
+        dst[i] = curve.encode((src[i] - black) * integerScale + integerBlackLevel);
     }
 }
 
 
-size_t DngFloatWriter::rawSize() {
-    // Worst case size
-    return tilesAcross * tilesDown * tileWidth * tileLength * (bps >> 3);
-}
-
-
-void DngFloatWriter::writeRawData() {
+void DngFloatWriter::compressTiles() {
+    Timer t("Compress raw data");
     size_t tileCount = tilesAcross * tilesDown;
-    uint32_t tileOffsets[tileCount];
-    uint32_t tileBytes[tileCount];
     int bytesps = bps >> 3;
-    uLongf dstLen = tileWidth * tileLength * bytesps;
-
+    size_t dstLen = tileWidth * tileLength * bytesps;
+    tileData.resize(tileCount);
+    tileBytes.assign(tileCount, 0);
+    // NewRawImageDigest is the MD5 of the MD5 digests of 256x256 tiles, in row order, as in the DNG SDK
+    const size_t digestTileSize = 256;
+    size_t digestTilesAcross = (width + digestTileSize - 1) / digestTileSize;
+    size_t digestTileCount = digestTilesAcross * ((height + digestTileSize - 1) / digestTileSize);
+    std::vector<QByteArray> tileDigests(digestTileCount);
+
+    // Compress each tile into its own buffer, in any order, and then hash the digest tiles
     #pragma omp parallel
     {
-        Bytef * cBuffer = new Bytef[dstLen];
-        Bytef * uBuffer = new Bytef[dstLen];
-
-        #pragma omp for collapse(2) schedule(dynamic)
+        DeflateCompressor compressor(compressionLevel);
+        size_t cBufferLen = DeflateCompressor::bound(dstLen);
+        BufferAllocator::Buffer<uint8_t> cBuffer = BufferAllocator::allocateBuffer<uint8_t>(cBufferLen);
+        BufferAllocator::Buffer<uint8_t> uBuffer = BufferAllocator::allocateBuffer<uint8_t>(dstLen);
+        std::unique_ptr<uint8_t[]> hBuffer(new uint8_t[digestTileSize * 4]);
+        std::unique_ptr<uint16_t[]> iBuffer(new uint16_t[digestTileSize]);
+
+        #pragma omp for collapse(2) schedule(dynamic) nowait
         for (size_t y = 0; y < height; y += tileLength) {
             for (size_t x = 0; x < width; x += tileWidth) {
                 size_t t = (y / tileLength) * tilesAcross + (x / tileWidth);
                 size_t thisTileLength = y + tileLength > height ? height - y : tileLength;
                 size_t thisTileWidth = x + tileWidth > width ? width - x : tileWidth;
-                if (thisTileLength != tileLength || thisTileWidth != tileWidth) {
-                    fill_n(uBuffer, dstLen, 0);
+                // encodeFloatRow already pads the columns past thisTileWidth
+                if (thisTileLength != tileLength) {
+                    size_t rowLen = tileWidth * bytesps;
+                    fill_n(uBuffer.get() + thisTileLength * rowLen, (tileLength - thisTileLength) * rowLen, 0);
                 }
                 for (size_t row = 0; row < thisTileLength; ++row) {
-                    Bytef * dst = uBuffer + row*tileWidth*bytesps;
-                    Bytef * src = (Bytef *)&rawData(x, y+row);
-                    compressFloats(src, thisTileWidth, bytesps);
-                    encodeFPDeltaRow(src, dst, thisTileWidth, tileWidth, bytesps, 2);
+                    uint8_t * dst = uBuffer.get() + row*tileWidth*bytesps;
+                    if (integerSamples) {
+                        uint16_t * dst16 = (uint16_t *)dst;
+                        encodeIntegerRow(x, y + row, thisTileWidth, dst16);
+                        std::fill(dst16 + thisTileWidth, dst16 + tileWidth, 0);
+                        // Horizontal difference with the previous sample of the same CFA column
+                        for (size_t col = tileWidth - 1; col >= 2; --col) {
+                            dst16[col] -= dst16[col - 2];
+                        }
+                    } else if (halfData.size() > 0) {
+                        encodeHalfRow(&halfData(x, y+row).bits, dst, thisTileWidth, tileWidth);
+                    } else {
+                        encodeFloatRow(&rawData(x, y+row), dst, thisTileWidth, tileWidth, bytesps);
+                    }
                 }
-                uLongf conpressedLength = dstLen;
-                int err = compress(cBuffer, &conpressedLength, uBuffer, dstLen);
-                tileBytes[t] = conpressedLength;
-                if (err != Z_OK) {
-                    std::cerr << "DNG Deflate: Failed compressing tile " << t << ", with error " << err << std::endl;
+                size_t conpressedLength = compressor.compress(uBuffer.get(), dstLen, cBuffer.get(), cBufferLen);
+                if (conpressedLength == 0) {
+                    std::cerr << "DNG Deflate: Failed compressing tile " << t << " with " << DeflateCompressor::backendName() << std::endl;
                 } else {
-                    #pragma omp critical
-                    {
-                        tileOffsets[t] = pos;
-                        std::copy_n((const uint8_t *)cBuffer, tileBytes[t], &fileData[pos]);
-                        pos += tileBytes[t];
-                    }
+                    tileBytes[t] = conpressedLength;
+                    tileData[t].reset(new uint8_t[conpressedLength]);
+                    std::copy_n(cBuffer.get(), conpressedLength, tileData[t].get());
                 }
             }
         }
 
-        delete [] cBuffer;
-        delete [] uBuffer;
+        #pragma omp for schedule(dynamic)
+        for (size_t t = 0; t < digestTileCount; ++t) {
+            size_t x = (t % digestTilesAcross) * digestTileSize, y = (t / digestTilesAcross) * digestTileSize;
+            size_t thisTileLength = std::min(digestTileSize, height - y);
+            size_t thisTileWidth = std::min(digestTileSize, width - x);
+            QCryptographicHash hash(QCryptographicHash::Md5);
+            for (size_t row = 0; row < thisTileLength; ++row) {
+                if (integerSamples) {
+                    encodeIntegerRow(x, y + row, thisTileWidth, iBuffer.get());
+                    hashRow(hash, iBuffer.get(), thisTileWidth, hBuffer.get());
+                } else if (halfData.size() > 0) {
+                    hashRow(hash, &halfData(x, y + row).bits, thisTileWidth, hBuffer.get());
+                } else {
+                    hashRow(hash, &rawData(x, y + row), thisTileWidth, bytesps, hBuffer.get());
+                }
+            }
+            tileDigests[t] = hash.result();
+        }
+    }
+
+    QCryptographicHash digest(QCryptographicHash::Md5);
+    for (const QByteArray & tileDigest : tileDigests) {
+        digest.addData(tileDigest);
+    }
+    rawImageDigest = digest.result();
+}
+
+
+void DngFloatWriter::writeRawData() {
+    size_t tileCount = tilesAcross * tilesDown;
+    std::vector<uint32_t> tileOffsets(tileCount);
+
+    // Exclusive prefix sum over the tile sizes, so that tiles are laid out in
+    // canonical order and the output does not depend on thread scheduling
+    for (size_t t = 0; t < tileCount; ++t) {
+        tileOffsets[t] = pos;
+        pos += tileBytes[t];
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t t = 0; t < tileCount; ++t) {
+        std::copy_n(tileData[t].get(), tileBytes[t], &fileData[tileOffsets[t]]);
+        tileData[t].reset();
     }
 
-    rawIFD.setValue(TILEOFFSETS, tileOffsets);
-    rawIFD.setValue(TILEBYTES, tileBytes);
+    rawIFD.setValue(TILEOFFSETS, (const void *)tileOffsets.data());
+    rawIFD.setValue(TILEBYTES, (const void *)tileBytes.data());
 }
 
 } // namespace hdrmerge
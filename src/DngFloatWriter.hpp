@@ -23,11 +23,18 @@
 #ifndef _DNGFLOATWRITER_HPP_
 #define _DNGFLOATWRITER_HPP_
 
+#include <memory>
+#include <vector>
 #include <QString>
 #include <QImage>
 #include "config.h"
 #include "Array2D.hpp"
+#include "BufferAllocator.hpp"
+#include "HalfFloat.hpp"
 #include "TiffDirectory.hpp"
+#include "DeflateCompressor.hpp"
+#include "ExifTransfer.hpp"
+#include "CompandingCurve.hpp"
 
 namespace hdrmerge {
 
@@ -35,7 +42,10 @@ class RawParameters;
 
 class DngFloatWriter {
 public:
-    DngFloatWriter() : previewWidth(0), bps(16) {}
+    static const int thumbnailWidth = 256;
+
+    DngFloatWriter() : previewWidth(0), bps(16), integerSamples(false), compressionLevel(DeflateCompressor::defaultLevel),
+        requestedTileWidth(0), requestedTileLength(0), hasMetadata(false) {}
 
     void setPreviewWidth(size_t w) {
         previewWidth = w;
@@ -43,28 +53,62 @@ public:
     void setBitsPerSample(int b) {
         bps = b;
     }
+    /// Stores 16-bit integers on a CompandingCurve, with its LinearizationTable, instead of floats.
+    void setIntegerSamples(bool i) {
+        integerSamples = i;
+    }
+    void setCompressionLevel(int l) {
+        compressionLevel = l;
+    }
+    /// Sets the size of the raw tiles, rounded up to a multiple of 16.
+    /// With zero, tiles of about 512KB are used.
+    void setTileSize(uint32_t w, uint32_t l) {
+        requestedTileWidth = w;
+        requestedTileLength = l;
+    }
+    /// Sets the metadata of the output. Otherwise, it is read from the file of the RawParameters.
+    void setMetadata(Exif::Metadata && m) {
+        metadata = std::move(m);
+        hasMetadata = true;
+    }
     void setPreview(const QImage & p);
     void write(Array2D<float> && rawPixels, const RawParameters & p, const QString & dstFileName);
+    /// Writes samples that are already rounded to half precision, with 16 bits per sample.
+    void write(Array2D<HalfFloat> && rawPixels, const RawParameters & p, const QString & dstFileName);
 
 private:
     int previewWidth;
     int bps;
+    bool integerSamples;
+    CompandingCurve curve;
+    float integerScale;
+    int compressionLevel;
+    uint32_t requestedTileWidth, requestedTileLength;
+    Exif::Metadata metadata;
+    bool hasMetadata;
     const RawParameters * params;
     Array2D<float> rawData;
-    std::unique_ptr<uint8_t[]> fileData;
+    Array2D<HalfFloat> halfData;
+    BufferAllocator::Buffer<uint8_t> fileData;
     size_t pos;
     IFD mainIFD, rawIFD, previewIFD;
     uint32_t width, height;
     uint32_t tileWidth, tileLength;
     uint32_t tilesAcross, tilesDown;
+    std::vector<std::unique_ptr<uint8_t[]>> tileData;
+    std::vector<uint32_t> tileBytes;
+    QByteArray rawImageDigest;
     QImage thumbnail;
     QImage preview;
     QByteArray jpegPreviewData;
     uint32_t subIFDoffsets[2];
 
+    void writeFile(const QString & dstFileName);
     void createMainIFD();
     void createRawIFD();
     void calculateTiles();
+    void compressTiles();
+    void encodeIntegerRow(size_t x, size_t y, size_t width, uint16_t * dst) const;
     void writeRawData();
     void renderPreviews();
     void writePreviews();
@@ -29,6 +29,7 @@
 #include <QFileDialog>
 #include <QSettings>
 #include <QSpinBox>
+#include <QSize>
 #include "DngPropertiesDialog.hpp"
 
 namespace hdrmerge {
@@ -43,14 +44,15 @@ DngPropertiesDialog::DngPropertiesDialog(QWidget * parent, Qt::WindowFlags f)
     QHBoxLayout * bpsSelectorLayout = new QHBoxLayout(bpsSelector);
     bpsSelectorLayout->setMargin(0);
     QButtonGroup * bpsGroup = new QButtonGroup(this);
-    const char * buttonLabels[] = { "16", "24", "32" };
-    int bpsIndex = (bps - 16) / 8;;
-    for (int i = 0; i < 3; ++i) {
-        QRadioButton * button = new QRadioButton(buttonLabels[i], this);
+    const char * buttonLabels[] = { "16", "24", "32", "16 integer" };
+    int bpsIndex = integerSamples ? 3 : (bps - 16) / 8;
+    for (int i = 0; i < 4; ++i) {
+        QRadioButton * button = new QRadioButton(tr(buttonLabels[i]), this);
         button->setChecked(i == bpsIndex);
         bpsGroup->addButton(button, i);
         bpsSelectorLayout->addWidget(button);
     }
+    bpsGroup->button(3)->setToolTip(tr("Integer samples on a companding curve, smaller and faster to decode."));
     connect(bpsGroup, SIGNAL(buttonClicked(int)), this, SLOT(setBps(int)));
 
     QWidget * previewSelector = new QWidget(this);
@@ -71,6 +73,30 @@ DngPropertiesDialog::DngPropertiesDialog(QWidget * parent, Qt::WindowFlags f)
     radiusSelector->setValue(featherRadius);
     connect(radiusSelector, SIGNAL(valueChanged(int)), this, SLOT(setFeatherRadius(int)));
 
+    QSpinBox * compressionSelector = new QSpinBox(this);
+    compressionSelector->setRange(0, 9);
+    compressionSelector->setValue(compressionLevel);
+    compressionSelector->setToolTip(tr("From 0 (no compression, fastest) to 9 (best compression, slowest)."));
+    connect(compressionSelector, SIGNAL(valueChanged(int)), this, SLOT(setCompressionLevel(int)));
+
+    tileSizeSelector = new QComboBox(this);
+    tileSizeSelector->addItem(tr("Automatic"), QSize(0, 0));
+    tileSizeSelector->addItem(tr("Small (%1x%1)").arg(smallTileSize), QSize(smallTileSize, smallTileSize));
+    tileSizeSelector->addItem(tr("Large (%1x%1)").arg(largeTileSize), QSize(largeTileSize, largeTileSize));
+    int tileSizeIndex = tileSizeSelector->findData(QSize(tileWidth, tileLength));
+    if (tileSizeIndex < 0) { // A custom size in the settings
+        tileSizeSelector->addItem(QString("%1x%2").arg(tileWidth).arg(tileLength), QSize(tileWidth, tileLength));
+        tileSizeIndex = tileSizeSelector->count() - 1;
+    }
+    tileSizeSelector->setCurrentIndex(tileSizeIndex);
+    tileSizeSelector->setToolTip(tr("Small tiles are faster to zoom in a raw editor, large ones compress slightly better."));
+    connect(tileSizeSelector, SIGNAL(currentIndexChanged(int)), this, SLOT(setTileSize(int)));
+
+    QCheckBox * activeAreaSelector = new QCheckBox(tr("Only the active area"), this);
+    activeAreaSelector->setChecked(activeAreaOnly);
+    activeAreaSelector->setToolTip(tr("Do not write the masked margins of the sensor, the file is slightly smaller."));
+    connect(activeAreaSelector, SIGNAL(stateChanged(int)), this, SLOT(setActiveAreaOnly(int)));
+
     QCheckBox * saveMaskFile = new QCheckBox(tr("Save"), this);
 
     maskFileSelector = new QWidget(this);
@@ -104,6 +130,9 @@ DngPropertiesDialog::DngPropertiesDialog(QWidget * parent, Qt::WindowFlags f)
     formLayout->addRow(tr("Bits per sample:"), bpsSelector);
     formLayout->addRow(tr("Preview size:"), previewSelector);
     formLayout->addRow(tr("Mask blur radius:"), radiusSelector);
+    formLayout->addRow(tr("Compression level:"), compressionSelector);
+    formLayout->addRow(tr("Tile size:"), tileSizeSelector);
+    formLayout->addRow(tr("Sensor margins:"), activeAreaSelector);
     formLayout->addRow(tr("Mask image:"), saveMaskFile);
     formLayout->addRow("", maskFileSelector);
     formWidget->setLayout(formLayout);
@@ -134,10 +163,15 @@ void DngPropertiesDialog::accept() {
     if (saveOptions->isChecked()) {
         QSettings settings;
         settings.setValue("bps", bps);
+        settings.setValue("integerSamples", integerSamples);
         settings.setValue("previewSize", previewSize);
         settings.setValue("saveMask", saveMask);
         settings.setValue("maskFileName", maskFileName);
         settings.setValue("featherRadius", featherRadius);
+        settings.setValue("compressionLevel", compressionLevel);
+        settings.setValue("tileWidth", tileWidth);
+        settings.setValue("tileLength", tileLength);
+        settings.setValue("activeAreaOnly", activeAreaOnly);
     }
     QDialog::accept();
 }
@@ -146,18 +180,25 @@ void DngPropertiesDialog::accept() {
 void DngPropertiesDialog::loadDefaultOptions() {
     QSettings settings;
     bps = settings.value("bps", 16).toInt();
+    integerSamples = settings.value("integerSamples", false).toBool();
     previewSize = settings.value("previewSize", 2).toInt();
     saveMask = settings.value("saveMask", false).toBool();
     maskFileName = settings.value("maskFileName", "%od/%of_mask.png").toString().toLocal8Bit().constData();
     featherRadius = settings.value("featherRadius", 3).toInt();
+    compressionLevel = settings.value("compressionLevel", 6).toInt();
+    tileWidth = settings.value("tileWidth", 0).toInt();
+    tileLength = settings.value("tileLength", 0).toInt();
+    activeAreaOnly = settings.value("activeAreaOnly", false).toBool();
 }
 
 
 void DngPropertiesDialog::setBps(int i) {
+    integerSamples = i == 3;
     switch (i) {
         case 0: bps = 16; break;
         case 1: bps = 24; break;
         case 2: bps = 32; break;
+        case 3: bps = 16; break;
     }
 }
 
@@ -184,4 +225,21 @@ void DngPropertiesDialog::setFeatherRadius(int r) {
 }
 
 
+void DngPropertiesDialog::setCompressionLevel(int l) {
+    compressionLevel = l;
+}
+
+
+void DngPropertiesDialog::setTileSize(int index) {
+    QSize size = tileSizeSelector->itemData(index).toSize();
+    tileWidth = size.width();
+    tileLength = size.height();
+}
+
+
+void DngPropertiesDialog::setActiveAreaOnly(int state) {
+    activeAreaOnly = state == 2;
+}
+
+
 } // namespace hdrmerge
@@ -26,6 +26,7 @@
 #include <QDialog>
 #include <QLineEdit>
 #include <QCheckBox>
+#include <QComboBox>
 #include "LoadSaveOptions.hpp"
 
 namespace hdrmerge {
@@ -49,6 +50,9 @@ private slots:
     void setMaskFileName();
     void setMaskFileSelectorEnabled(int state);
     void setFeatherRadius(int r);
+    void setCompressionLevel(int l);
+    void setTileSize(int index);
+    void setActiveAreaOnly(int state);
 
 private:
     Q_OBJECT
@@ -58,6 +62,7 @@ private:
     QLineEdit * maskFileEditor;
     QWidget * maskFileSelector;
     QCheckBox * saveOptions;
+    QComboBox * tileSizeSelector;
 };
 
 } // namespace hdrmerge
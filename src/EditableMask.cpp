@@ -20,12 +20,17 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
 #include "EditableMask.hpp"
 using namespace hdrmerge;
 
 
 void EditableMask::startAction(bool add, int layer) {
     editActions.erase(nextAction, editActions.end());
+    if (!editActions.empty()) {
+        editActions.back().spans.shrink_to_fit();
+    }
     editActions.emplace_back();
     nextAction = editActions.end();
     editActions.back().oldLayer = add ? layer + 1 : layer;
@@ -35,12 +40,35 @@ void EditableMask::startAction(bool add, int layer) {
 
 void EditableMask::editPixels(int x, int y, size_t radius) {
     EditAction & e = editActions.back();
-    traceCircle(x, y, radius, [&] (int col, int row, uint8_t & layer) {
-        if (layer == e.oldLayer && isLayerValidAt(e.newLayer, col, row)) {
-            e.points.push_back({col, row});
-            layer = e.newLayer;
+    int r = radius, r2 = r * r;
+    std::vector<uint8_t> layers(2 * r + 1);
+    int ymin = std::max(y - r, 0), ymax = std::min(y + r + 1, (int)getHeight());
+    for (int row = ymin; row < ymax; ++row) {
+        // Half width of the circle in this row
+        int dy2 = (row - y) * (row - y), half = std::sqrt(r2 - dy2);
+        while (half * half + dy2 > r2) --half;
+        while ((half + 1) * (half + 1) + dy2 <= r2) ++half;
+        int xmin = std::max(x - half, 0), xmax = std::min(x + half + 1, (int)getWidth());
+        if (xmin >= xmax) continue;
+        getRow(row, xmin, xmax - xmin, layers.data());
+        // Change the runs of pixels of the old layer where the new one is valid
+        for (int col = xmin; col < xmax;) {
+            int start = col;
+            while (col < xmax && layers[col - xmin] == e.oldLayer && isLayerValidAt(e.newLayer, col, row)) {
+                ++col;
+            }
+            if (col > start) {
+                setSpan(row, start, col, e.newLayer);
+                if (!e.spans.empty() && e.spans.back().y == row && e.spans.back().x1 == start) {
+                    e.spans.back().x1 = col;
+                } else {
+                    e.spans.push_back({row, start, col});
+                }
+            } else {
+                ++col;
+            }
         }
-    });
+    }
 }
 
 
@@ -48,7 +76,7 @@ QRect EditableMask::undo() {
     QRect result;
     if (nextAction != editActions.begin()) {
         --nextAction;
-        result = modifyLayer(nextAction->points, nextAction->oldLayer);
+        result = modifyLayer(nextAction->spans, nextAction->oldLayer);
     }
     return result;
 }
@@ -57,22 +85,25 @@ QRect EditableMask::undo() {
 QRect EditableMask::redo() {
     QRect result;
     if (nextAction != editActions.end()) {
-        result = modifyLayer(nextAction->points, nextAction->newLayer);
+        result = modifyLayer(nextAction->spans, nextAction->newLayer);
         ++nextAction;
     }
     return result;
 }
 
 
-QRect EditableMask::modifyLayer(const std::list<QPoint> & points, int layer) {
-    if (points.empty()) {
+QRect EditableMask::modifyLayer(const std::vector<Span> & spans, int layer) {
+    if (spans.empty()) {
         return QRect(0, 0, 0, 0);
     } else {
-        QRect a(points.front(), points.front());
-        for (auto p : points) {
-            operator()(p.x(), p.y()) = layer;
-            a = a.united(QRect(p, p));
+        int left = spans.front().x0, right = spans.front().x1, top = spans.front().y, bottom = top;
+        for (auto & s : spans) {
+            setSpan(s.y, s.x0, s.x1, layer);
+            left = std::min(left, s.x0);
+            right = std::max(right, s.x1);
+            top = std::min(top, s.y);
+            bottom = std::max(bottom, s.y);
         }
-        return a;
+        return QRect(QPoint(left, top), QPoint(right - 1, bottom));
     }
 }
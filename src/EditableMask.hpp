@@ -25,12 +25,13 @@
 
 #include <cstdint>
 #include <list>
+#include <vector>
 #include <QRect>
-#include "Array2D.hpp"
+#include "TiledMask.hpp"
 
 namespace hdrmerge {
 
-class EditableMask : public Array2D<uint8_t> {
+class EditableMask : public TiledMask {
 public:
     EditableMask() : nextAction(editActions.end()) {}
     void reset() {
@@ -50,15 +51,19 @@ public:
     QRect redo();
 
 private:
+    /// Pixels from x0 to x1, excluded, of row y
+    struct Span {
+        int y, x0, x1;
+    };
     struct EditAction {
         int oldLayer, newLayer;
-        std::list<QPoint> points;
+        std::vector<Span> spans;
     };
 
     std::list<EditAction> editActions;
     std::list<EditAction>::iterator nextAction;
 
-    QRect modifyLayer(const std::list<QPoint> & points, int oldayer);
+    QRect modifyLayer(const std::vector<Span> & spans, int layer);
     virtual bool isLayerValidAt(int layer, int x, int y) const = 0;
 };
 
@@ -23,100 +23,13 @@
 #include <exiv2/exiv2.hpp>
 #include <iostream>
 #include "ExifTransfer.hpp"
+#include "TiffDirectory.hpp"
 #include "Log.hpp"
 using namespace hdrmerge;
 using namespace Exiv2;
 using namespace std;
 
 
-class ExifTransfer {
-public:
-    ExifTransfer(const QString & srcFile, const QString & dstFile,
-                 const uint8_t * data, size_t dataSize)
-    : srcFile(srcFile), dstFile(dstFile), data(data), dataSize(dataSize) {}
-
-    void copyMetadata();
-
-private:
-    QString srcFile, dstFile;
-    const uint8_t * data;
-    size_t dataSize;
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr src, dst;
-#else
-    Exiv2::Image::AutoPtr src, dst;
-#endif
-
-    void copyXMP();
-    void copyIPTC();
-    void copyEXIF();
-};
-
-
-void hdrmerge::Exif::transfer(const QString & srcFile, const QString & dstFile,
-                 const uint8_t * data, size_t dataSize) {
-    ExifTransfer exif(srcFile, dstFile, data, dataSize);
-    exif.copyMetadata();
-}
-
-
-void ExifTransfer::copyMetadata() {
-    try {
-#if EXIV2_TEST_VERSION(0,28,0)
-        dst = Exiv2::ImageFactory::open(BasicIo::UniquePtr(new MemIo(data, dataSize)));
-#else
-        dst = Exiv2::ImageFactory::open(BasicIo::AutoPtr(new MemIo(data, dataSize)));
-#endif
-        dst->readMetadata();
-    } catch (Exiv2::Error & e) {
-        std::cerr << "Exiv2 error: " << e.what() << std::endl;
-        return;
-    }
-    try {
-        src = Exiv2::ImageFactory::open(srcFile.toLocal8Bit().constData());
-        src->readMetadata();
-        copyXMP();
-        copyIPTC();
-        copyEXIF();
-    } catch (Exiv2::Error & e) {
-        std::cerr << "Exiv2 error: " << e.what() << std::endl;
-        // At least we have to set the SubImage1 file type to Primary Image
-        dst->exifData()["Exif.SubImage1.NewSubfileType"] = 0;
-    }
-    try {
-        dst->writeMetadata();
-        FileIo fileIo(dstFile.toLocal8Bit().constData());
-        fileIo.open("wb");
-        fileIo.write(dst->io());
-        fileIo.close();
-    } catch (Exiv2::Error & e) {
-        std::cerr << "Exiv2 error: " << e.what() << std::endl;
-    }
-}
-
-
-void ExifTransfer::copyXMP() {
-    const Exiv2::XmpData & srcXmp = src->xmpData();
-    Exiv2::XmpData & dstXmp = dst->xmpData();
-    for (const auto & datum : srcXmp) {
-        if (datum.groupName() != "tiff" && dstXmp.findKey(Exiv2::XmpKey(datum.key())) == dstXmp.end()) {
-            dstXmp.add(datum);
-        }
-    }
-}
-
-
-void ExifTransfer::copyIPTC() {
-    const Exiv2::IptcData & srcIptc = src->iptcData();
-    Exiv2::IptcData & dstIptc = dst->iptcData();
-    for (const auto & datum : srcIptc) {
-        if (dstIptc.findKey(Exiv2::IptcKey(datum.key())) == dstIptc.end()) {
-            dstIptc.add(datum);
-        }
-    }
-}
-
-
 static bool excludeExifDatum(const Exifdatum & datum) {
     static const char * previewKeys[] {
         "Exif.OlympusCs.PreviewImageStart",
@@ -153,7 +66,7 @@ static bool excludeExifDatum(const Exifdatum & datum) {
 }
 
 
-void ExifTransfer::copyEXIF() {
+static void copyEXIF(const Exiv2::ExifData & srcExif, Exiv2::ExifData & dstExif) {
     static const char * includeImageKeys[] = {
         // Correct Make and Model, from the input files
         // It is needed so that makernote tags are correctly copied
@@ -162,28 +75,77 @@ void ExifTransfer::copyEXIF() {
         "Exif.Image.Artist",
         "Exif.Image.Copyright",
         "Exif.Image.DNGPrivateData",
-        // Opcodes generated by Adobe DNG converter
-        "Exif.SubImage1.OpcodeList1",
-        "Exif.SubImage1.OpcodeList2",
-        "Exif.SubImage1.OpcodeList3"
     };
 
-    const Exiv2::ExifData & srcExif = src->exifData();
-    Exiv2::ExifData & dstExif = dst->exifData();
-
     for (const char * keyName : includeImageKeys) {
         auto iterator = srcExif.findKey(Exiv2::ExifKey(keyName));
         if (iterator != srcExif.end()) {
-            dstExif[keyName] = *iterator;
+            dstExif.add(*iterator);
         }
     }
-    // Now we set the SubImage1 file type to Primary Image
-    // Exiv2 wouldn't modify SubImage1 tags if it was set before
-    dstExif["Exif.SubImage1.NewSubfileType"] = 0u;
-
     for (const auto & datum : srcExif) {
-        if (!excludeExifDatum(datum) && dstExif.findKey(Exiv2::ExifKey(datum.key())) == dstExif.end()) {
+        if (!excludeExifDatum(datum)) {
             dstExif.add(datum);
         }
     }
 }
+
+
+static void copyXMP(const Exiv2::XmpData & srcXmp, Exiv2::XmpData & dstXmp) {
+    for (const auto & datum : srcXmp) {
+        if (datum.groupName() != "tiff") {
+            dstXmp.add(datum);
+        }
+    }
+}
+
+
+Exif::Metadata::Metadata(const QString & srcFile) {
+    static const char * rawImageKeys[] = {
+        // Opcodes generated by Adobe DNG converter
+        "Exif.SubImage1.OpcodeList1",
+        "Exif.SubImage1.OpcodeList2",
+        "Exif.SubImage1.OpcodeList3"
+    };
+
+    Timer t("Read metadata");
+    // Same byte order as the IFDs of DngFloatWriter
+    Exiv2::ByteOrder byteOrder = hdrmerge::TiffHeader().sep.endian == 0x4949 ? littleEndian : bigEndian;
+    try {
+        auto src = Exiv2::ImageFactory::open(srcFile.toLocal8Bit().constData());
+        src->readMetadata();
+        Exiv2::ExifData exif;
+        Exiv2::IptcData iptc = src->iptcData();
+        Exiv2::XmpData xmp;
+        copyEXIF(src->exifData(), exif);
+        copyXMP(src->xmpData(), xmp);
+
+        for (const char * keyName : rawImageKeys) {
+            auto iterator = src->exifData().findKey(Exiv2::ExifKey(keyName));
+            if (iterator != src->exifData().end()) {
+                RawTag raw = { iterator->tag(), std::vector<uint8_t>(iterator->size()) };
+                iterator->copy(raw.value.data(), byteOrder);
+                rawTags.push_back(std::move(raw));
+            }
+        }
+
+        // Let Exiv2 lay out the EXIF, GPS and makernote IFDs, it knows how to fix the makernote offsets
+        MemIo io;
+        TiffParser::encode(io, nullptr, 0, byteOrder, exif, iptc, xmp);
+        stream.resize(io.size());
+        io.seek(0, BasicIo::beg);
+        io.read(stream.data(), stream.size());
+    } catch (Exiv2::Error & e) {
+        std::cerr << "Exiv2 error: " << e.what() << std::endl;
+        stream.clear();
+        rawTags.clear();
+    }
+}
+
+
+void Exif::Metadata::addTo(IFD & mainIFD, IFD & rawIFD) const {
+    mainIFD.addEntries(stream.data(), stream.size());
+    for (const auto & raw : rawTags) {
+        rawIFD.addEntry(raw.tag, IFD::UNDEFINED, raw.value.size(), raw.value.data());
+    }
+}
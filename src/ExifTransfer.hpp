@@ -23,15 +23,50 @@
 #ifndef _EXIFTRANSFER_HPP_
 #define _EXIFTRANSFER_HPP_
 
+#include <vector>
 #include <QString>
 
 namespace hdrmerge {
 
-    namespace Exif {
-        void transfer(const QString & srcFile, const QString & dstFile,
-                 const uint8_t * data, size_t dataSize);
+class IFD;
+
+namespace Exif {
+
+/// The metadata of a source raw file: EXIF (with the maker notes), IPTC and XMP. It is read
+/// and encoded as a TIFF stream once, with the byte order of the host. DngFloatWriter places
+/// that stream at the beginning of the output, so that its offsets are still valid, and
+/// copies the entries of its first IFD to the main IFD.
+class Metadata {
+public:
+    Metadata() {}
+    explicit Metadata(const QString & srcFile);
+
+    bool empty() const {
+        return stream.empty();
+    }
+    /// The TIFF stream, to be written at offset zero
+    const std::vector<uint8_t> & data() const {
+        return stream;
     }
+    /// Adds the main metadata tags to mainIFD, and the opcode lists of the source raw image to rawIFD
+    void addTo(IFD & mainIFD, IFD & rawIFD) const;
+    /// Drops the opcode lists, whose areas are only valid with the geometry of the source raw image
+    void dropRawTags() {
+        rawTags.clear();
+    }
+
+private:
+    struct RawTag {
+        uint16_t tag;
+        std::vector<uint8_t> value;
+    };
+
+    std::vector<uint8_t> stream;
+    std::vector<RawTag> rawTags;
+};
+
+} // namespace Exif
 
-}
+} // namespace hdrmerge
 
 #endif // _EXIFTRANSFER_HPP_
@@ -0,0 +1,168 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "FloatTileEncoder.hpp"
+#include "SimdKernels.hpp"
+
+namespace hdrmerge {
+
+// From DNG SDK dng_utils.h
+uint16_t DNG_FloatToHalf(uint32_t i) {
+    int32_t sign     =  (i >> 16) & 0x00008000;
+    int32_t exponent = ((i >> 23) & 0x000000ff) - (127 - 15);
+    int32_t mantissa =   i            & 0x007fffff;
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return (uint16_t)sign;
+        }
+        mantissa = (mantissa | 0x00800000) >> (1 - exponent);
+        if (mantissa &  0x00001000)
+            mantissa += 0x00002000;
+        return (uint16_t)(sign | (mantissa >> 13));
+    } else if (exponent == 0xff - (127 - 15)) {
+        if (mantissa == 0) {
+            return (uint16_t)(sign | 0x7c00);
+        } else {
+            return (uint16_t)(sign | 0x7c00 | (mantissa >> 13));
+        }
+    }
+    if (mantissa & 0x00001000) {
+        mantissa += 0x00002000;
+        if (mantissa & 0x00800000) {
+            mantissa =  0;          // overflow in significand,
+            exponent += 1;          // adjust exponent
+        }
+    }
+    if (exponent > 30) {
+        return (uint16_t)(sign | 0x7c00); // infinity with the same sign as f.
+    }
+    return (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+
+uint32_t DNG_HalfToFloat(uint16_t halfValue) {
+    int32_t sign     = (halfValue >> 15) & 0x00000001;
+    int32_t exponent = (halfValue >> 10) & 0x0000001f;
+    int32_t mantissa =  halfValue        & 0x000003ff;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            // Plus or minus zero
+            return (uint32_t) (sign << 31);
+        } else {
+            // Denormalized number -- renormalize it
+            while (!(mantissa & 0x00000400)) {
+                mantissa <<= 1;
+                exponent -=  1;
+            }
+            exponent += 1;
+            mantissa &= ~0x00000400;
+        }
+    } else if (exponent == 31) {
+        if (mantissa == 0) {
+            // Positive or negative infinity, convert to maximum (16 bit) values.
+            return (uint32_t) ((sign << 31) | ((0x1eL + 127 - 15) << 23) |  (0x3ffL << 13));
+        } else {
+            // Nan -- Just set to zero.
+            return 0;
+        }
+    }
+    // Normalized number
+    exponent += (127 - 15);
+    mantissa <<= 13;
+    return (uint32_t) ((sign << 31) | (exponent << 23) | mantissa);
+}
+
+
+void DNG_FloatToFP24(uint32_t input, uint8_t *output) {
+    int32_t exponent = (int32_t) ((input >> 23) & 0xFF) - 128;
+    int32_t mantissa = input & 0x007FFFFF;
+    if (exponent == 127) {
+        if (mantissa != 0x007FFFFF && ((mantissa >> 7) == 0xFFFF)) {
+            mantissa &= 0x003FFFFF;         // knock out msb to make it a NaN
+        }
+    } else if (exponent > 63) {
+        exponent = 63;
+        mantissa = 0x007FFFFF;
+    } else if (exponent <= -64) {
+        if (exponent >= -79) {
+            mantissa = (mantissa | 0x00800000) >> (-63 - exponent);
+        } else {
+            mantissa = 0;
+        }
+        exponent = -64;
+    }
+    output [0] = (uint8_t)(((input >> 24) & 0x80) | (uint32_t) (exponent + 64));
+    output [1] = (mantissa >> 15) & 0x00FF;
+    output [2] = (mantissa >>  7) & 0x00FF;
+}
+
+
+namespace {
+
+// The encoded sample, right-aligned in 32 bits. The vector kernels must match it exactly,
+// so that the output does not depend on the CPU. That rules out the F16C conversion,
+// which rounds ties to even.
+inline uint32_t encodeSample(float f, int bytesps) {
+    uint32_t i;
+    std::memcpy(&i, &f, 4);
+    if (bytesps == 2) {
+        return DNG_FloatToHalf(i);
+    } else if (bytesps == 3) {
+        uint8_t fp24[3];
+        DNG_FloatToFP24(i, fp24);
+        return (fp24[0] << 16) | (fp24[1] << 8) | fp24[2];
+    } else {
+        return i;
+    }
+}
+
+} // namespace
+
+
+void encodeFloatRow(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps) {
+    const SimdKernels & simd = SimdKernels::get();
+    size_t col = simd.splitFloatPlanes(src, dst, width, tileWidth, bytesps);
+    for (; col < width; ++col) {
+        uint32_t v = encodeSample(src[col], bytesps);
+        for (int plane = 0; plane < bytesps; ++plane) {
+            dst[plane*tileWidth + col] = v >> (8 * (bytesps - 1 - plane));
+        }
+    }
+    for (int plane = 0; plane < bytesps; ++plane) {
+        std::fill(&dst[plane*tileWidth + width], &dst[(plane + 1)*tileWidth], 0);
+    }
+    simd.encodeDelta(dst, tileWidth * bytesps);
+}
+
+void encodeHalfRow(const uint16_t * src, uint8_t * dst, size_t width, size_t tileWidth) {
+    for (size_t col = 0; col < width; ++col) {
+        dst[col] = src[col] >> 8;
+        dst[tileWidth + col] = src[col];
+    }
+    std::fill(&dst[width], &dst[tileWidth], 0);
+    std::fill(&dst[tileWidth + width], &dst[2*tileWidth], 0);
+    SimdKernels::get().encodeDelta(dst, tileWidth * 2);
+}
+
+} // namespace hdrmerge
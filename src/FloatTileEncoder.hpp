@@ -0,0 +1,46 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _FLOATTILEENCODER_HPP_
+#define _FLOATTILEENCODER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hdrmerge {
+
+/// Encodes a row of a floating point DNG tile: converts the samples to 16, 24 or 32 bits,
+/// splits them in byte planes (most significant byte first) and applies the delta of
+/// predictor 34894 with a factor of 2. The source row is not modified. Columns from
+/// width to tileWidth are encoded as zeros.
+void encodeFloatRow(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps);
+/// Same as encodeFloatRow, for samples that are already in half precision.
+void encodeHalfRow(const uint16_t * src, uint8_t * dst, size_t width, size_t tileWidth);
+
+// From DNG SDK dng_utils.h
+uint16_t DNG_FloatToHalf(uint32_t i);
+uint32_t DNG_HalfToFloat(uint16_t halfValue);
+void DNG_FloatToFP24(uint32_t input, uint8_t * output);
+
+} // namespace hdrmerge
+
+#endif // _FLOATTILEENCODER_HPP_
@@ -0,0 +1,55 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _HALFFLOAT_HPP_
+#define _HALFFLOAT_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include "FloatTileEncoder.hpp"
+
+namespace hdrmerge {
+
+/// A half precision float, rounded as in 16-bit floating point DNG files. It converts
+/// implicitly to float, so that the code that reads raw data works with both types.
+struct HalfFloat {
+    uint16_t bits;
+
+    HalfFloat() = default;
+    explicit HalfFloat(float f) {
+        uint32_t i;
+        std::memcpy(&i, &f, 4);
+        bits = DNG_FloatToHalf(i);
+    }
+    operator float() const {
+        uint32_t i = DNG_HalfToFloat(bits);
+        float f;
+        std::memcpy(&f, &i, 4);
+        return f;
+    }
+};
+
+static_assert(sizeof(HalfFloat) == 2, "Rows of HalfFloat are encoded as arrays of uint16_t");
+
+} // namespace hdrmerge
+
+#endif // _HALFFLOAT_HPP_
@@ -20,8 +20,11 @@
  *
  */
 
+#include <cmath>
 #include "Image.hpp"
 #include "Bitmap.hpp"
+#include "CFALookup.hpp"
+#include "CFAPattern.hpp"
 #include "Histogram.hpp"
 #include "Log.hpp"
 #include "RawParameters.hpp"
@@ -42,17 +45,21 @@ void Image::ResponseFunction::setLinear(double slope) {
 void Image::buildImage(uint16_t * rawImage, const RawParameters & params) {
     resize(params.width, params.height);
     size_t size = width*height;
-    brightness = 0.0;
-    max = 0;
-    for (size_t y = 0, ry = params.topMargin; y < height; ++y, ++ry) {
-        for (size_t x = 0, rx = params.leftMargin; x < width; ++x, ++rx) {
-            uint16_t v = rawImage[ry*params.rawWidth + rx];
+    double sum = 0.0;
+    uint16_t maxValue = 0;
+    // By rows in parallel, like the loops that process the image later
+    #pragma omp parallel for reduction(+:sum) reduction(max:maxValue)
+    for (size_t y = 0; y < height; ++y) {
+        const uint16_t * src = &rawImage[(y + params.topMargin) * params.rawWidth + params.leftMargin];
+        for (size_t x = 0; x < width; ++x) {
+            uint16_t v = src[x];
             (*this)(x, y) = v;
-            brightness += v;
-            if (v > max) max = v;
+            sum += v;
+            if (v > maxValue) maxValue = v;
         }
     }
-    brightness /= size;
+    brightness = sum / size;
+    max = maxValue;
     response.setLinear(params.max == 0 ? 1.0 : 65535.0 / params.max);
     subtractBlack(params);
 }
@@ -67,28 +74,94 @@ Image & Image::operator=(Image && move) {
     brightness = move.brightness;
     response = move.response;
     halfLightPercent = move.halfLightPercent;
+    frame = std::move(move.frame);
+    viewRows = move.viewRows;
     return *this;
 }
 
 
+void Image::compress() {
+    frame = std::make_shared<const CompressedFrame>(data.get(), width, height);
+    Log::debug("Compressed ", filename, " to ", frame->memoryUsage() >> 10, "KB");
+    data = allocate(0);
+    alignedData = nullptr;
+    viewRows = 0;
+}
+
+
+Image Image::view() const {
+    Image result;
+    result.filename = filename;
+    result.width = width;
+    result.height = height;
+    result.dx = dx;
+    result.dy = dy;
+    result.alignedData = nullptr;
+    result.satThreshold = satThreshold;
+    result.max = max;
+    result.brightness = brightness;
+    result.response = response;
+    result.halfLightPercent = halfLightPercent;
+    result.frame = frame;
+    return result;
+}
+
+
+void Image::loadRows(int y0, int y1) {
+    // getMaxAround also reads the rows above and below
+    size_t first = std::min(std::max(y0 - 1 - dy, 0), (int)height);
+    size_t last = std::min(std::max(y1 + 1 - dy, 0), (int)height);
+    if (last - first > viewRows) {
+        viewRows = last - first;
+        data = allocate(viewRows * width);
+    }
+    frame->decodeRows(first, last - first, data.get());
+    alignedData = data.get() - ((ptrdiff_t)first + dy) * (ptrdiff_t)width - dx;
+}
+
+
+const uint16_t * Image::getRows(size_t first, size_t count, std::vector<uint16_t> & buffer) const {
+    if (!frame) {
+        return &data[first * width];
+    }
+    buffer.resize(count * width);
+    frame->decodeRows(first, count, buffer.data());
+    return buffer.data();
+}
+
+
 void Image::setSaturationThreshold(uint16_t sat) {
     satThreshold = sat;
     response.threshold = 0.9*sat;
 }
 
 
-void Image::subtractBlack(const RawParameters & params) {
-    if (params.hasBlack()) {
-        for (size_t y = 0, pos = 0; y < height; ++y) {
-            for (size_t x = 0; x < width; ++x, ++pos) {
-                if ((*this)[pos] > params.blackAt(x, y)) {
-                    (*this)[pos] -= params.blackAt(x, y);
-                } else {
-                    (*this)[pos] = 0;
-                }
+namespace {
+
+// Subtracts the black level of each pixel, clamping at zero
+struct SubtractBlack {
+    Array2D<uint16_t> & image;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        size_t width = image.getWidth(), height = image.getHeight();
+        #pragma omp parallel for
+        for (size_t y = 0; y < height; ++y) {
+            const typename CFA::Row & row = cfa.row(y);
+            for (size_t x = 0, pos = y * width; x < width; ++x, ++pos) {
+                uint16_t black = row.black[x % CFA::columns];
+                image[pos] = image[pos] > black ? image[pos] - black : 0;
             }
         }
     }
+};
+
+} // namespace
+
+
+void Image::subtractBlack(const RawParameters & params) {
+    if (params.hasBlack()) {
+        dispatchCFA(params, SubtractBlack{*this});
+    }
 }
 
 
@@ -104,26 +177,45 @@ void Image::computeResponseFunction(const Image & r) {
     int reldy = dy - std::max(dy, r.dy);
     int relrdy = r.dy - std::max(dy, r.dy);
     int h = height + reldy + relrdy;
-    uint16_t * usePixels = &data[-reldy*width - reldx];
-    const uint16_t * rUsePixels = &r.data[-relrdy*width - relrdx];
+    // Compressed images are decoded by bands of rows
+    const int bandRows = CompressedFrame::stripRows;
+
+    // The response of the next image is accumulated in fixed point, so that the sums are exact
+    // and the result does not depend on how pixels are distributed among threads
+    std::vector<int64_t> nextResponse(satThreshold);
+    double maxResponse = 1.0;
+    for (int nv = 0; nv < satThreshold; ++nv) {
+        maxResponse = std::max(maxResponse, std::abs(r.response(nv)));
+    }
+    double responseScale = std::ldexp(1.0, 62) / (maxResponse * std::max((double)w * h, 1.0));
+    responseScale = std::ldexp(1.0, std::ilogb(responseScale));
+    for (int nv = 0; nv < satThreshold; ++nv) {
+        nextResponse[nv] = std::llround(r.response(nv) * responseScale);
+    }
 
     // Get average relative values between this image and the last one
-    std::vector<std::pair<int, double>> histogram(max + 1);
-    for (auto & i : histogram) i = { 0, 0.0 };
+    std::vector<std::pair<int, int64_t>> histogram(max + 1);
+    for (auto & i : histogram) i = { 0, 0 };
     #pragma omp parallel
     {
         // use one histogram per thread
-        std::vector<std::pair<int, double>> histogramThr(max + 1);
-        for (auto & i : histogramThr) i = { 0, 0.0 };
+        std::vector<std::pair<int, int64_t>> histogramThr(max + 1);
+        for (auto & i : histogramThr) i = { 0, 0 };
+        std::vector<uint16_t> buffer, rBuffer;
         #pragma omp for nowait
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) {
-                int pos = y * width + x;
-                uint16_t v = usePixels[pos];
-                uint16_t nv = rUsePixels[pos];
-                if (v >= nv && v < satThreshold) {
-                    histogramThr[v].first++;
-                    histogramThr[v].second += r.response(nv);
+        for (int b = 0; b < h; b += bandRows) {
+            int rows = std::min(bandRows, h - b);
+            const uint16_t * usePixels = getRows(b - reldy, rows, buffer) - reldx;
+            const uint16_t * rUsePixels = r.getRows(b - relrdy, rows, rBuffer) - relrdx;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    int pos = y * width + x;
+                    uint16_t v = usePixels[pos];
+                    uint16_t nv = rUsePixels[pos];
+                    if (v >= nv && v < satThreshold) {
+                        histogramThr[v].first++;
+                        histogramThr[v].second += nextResponse[nv];
+                    }
                 }
             }
         }
@@ -145,7 +237,7 @@ void Image::computeResponseFunction(const Image & r) {
     for (int v = max - 1; v >= max*0.75; --v) {
         if (histogram[v].first > 2) {
             values[i] = v;
-            adjValues[i] = histogram[v].second / histogram[v].first;
+            adjValues[i] = histogram[v].second / responseScale / histogram[v].first;
             ++i;
         }
     }
@@ -160,14 +252,20 @@ void Image::computeResponseFunction(const Image & r) {
         // Minimize square error between images:
         // min. C(n) = sum(n*f(x) - g(x))^2  ->  n = sum(f(x)*g(x)) / sum(f(x)^2)
         double numerator = 0, denom = 0;
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) {
-                int pos = y * width + x;
-                double v = usePixels[pos];
-                double nv = rUsePixels[pos];
-                if (v >= nv && v < satThreshold) {
-                    numerator += v * r.response(nv);
-                    denom += v * v;
+        std::vector<uint16_t> buffer, rBuffer;
+        for (int b = 0; b < h; b += bandRows) {
+            int rows = std::min(bandRows, h - b);
+            const uint16_t * usePixels = getRows(b - reldy, rows, buffer) - reldx;
+            const uint16_t * rUsePixels = r.getRows(b - relrdy, rows, rBuffer) - relrdx;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    int pos = y * width + x;
+                    double v = usePixels[pos];
+                    double nv = rUsePixels[pos];
+                    if (v >= nv && v < satThreshold) {
+                        numerator += v * r.response(nv);
+                        denom += v * v;
+                    }
                 }
             }
         }
@@ -179,8 +277,6 @@ void Image::computeResponseFunction(const Image & r) {
 size_t Image::alignWith(const Image & r) {
     dx = dy = 0;
     const double tolerance = 1.0/16;
-    Histogram histFull(begin(), end());
-    double halfLightPercent = histFull.getFraction(satThreshold) / 2.0;
     size_t totalError = 0;
     for (int s = scaleSteps - 1; s >= 0; --s) {
         size_t curWidth = width >> (s + 1);
@@ -224,23 +320,81 @@ size_t Image::alignWith(const Image & r) {
 
 
 void Image::preScale() {
-    size_t curWidth = width;
-    size_t curHeight = height;
-    Array2D<uint16_t> * r2 = this;
+    buildPyramid(0xF);
+}
+
+
+unsigned Image::greenCells(const CFAPattern & FC) {
+    // Green is the colour with two phases in a 2x2 pattern, colours 1 and 3
+    unsigned greens = 0;
+    int numGreens = 0;
+    if (FC.getColumns() == 2 && FC.getRows() == 2) {
+        for (int i = 0; i < 4; ++i) {
+            if (FC(i & 1, i >> 1) & 1) {
+                greens |= 1 << i;
+                ++numGreens;
+            }
+        }
+    }
+    return numGreens == 2 ? greens : 0;
+}
 
+
+void Image::preScale(const CFAPattern & FC) {
+    unsigned greens = greenCells(FC);
+    buildPyramid(greens ? greens : 0xF);
+}
+
+
+void Image::buildPyramid(unsigned cells) {
+    size_t offsets[4];
+    int numCells = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (cells & (1 << i)) {
+            offsets[numCells++] = (i >> 1) * width + (i & 1);
+        }
+    }
     scaled.reset(new Array2D<uint16_t>[scaleSteps]);
-    for (int s = 0; s < scaleSteps; ++s) {
+    size_t curWidth = width >> 1;
+    size_t curHeight = height >> 1;
+    scaled[0].resize(curWidth, curHeight);
+    // alignWith thresholds the levels at the same fraction of light pixels as the full image
+    Histogram histogram;
+    // By bands of an even number of rows, so that a compressed image is never decoded at once
+    const size_t bandRows = CompressedFrame::stripRows;
+    std::vector<uint16_t> buffer;
+    for (size_t y0 = 0; y0 < height; y0 += bandRows) {
+        size_t rows = std::min(bandRows, height - y0);
+        const uint16_t * band = getRows(y0, rows, buffer);
+        for (size_t i = 0; i < rows * width; ++i) {
+            histogram.addValue(band[i]);
+        }
+        for (size_t y = y0 >> 1; y < std::min((y0 + rows) >> 1, curHeight); ++y) {
+            const uint16_t * cell = band + (2 * y - y0) * width;
+            uint16_t * dst = &scaled[0](0, y);
+            for (size_t x = 0; x < curWidth; ++x, cell += 2) {
+                uint32_t sum = 0;
+                for (int i = 0; i < numCells; ++i) {
+                    sum += cell[offsets[i]];
+                }
+                dst[x] = sum / numCells;
+            }
+        }
+    }
+    halfLightPercent = histogram.getFraction(satThreshold) / 2.0;
+
+    for (int s = 1; s < scaleSteps; ++s) {
+        const Array2D<uint16_t> & r2 = scaled[s - 1];
         scaled[s].resize(curWidth >>= 1, curHeight >>= 1);
         for (size_t y = 0, prevY = 0; y < curHeight; ++y, prevY += 2) {
             for (size_t x = 0, prevX = 0; x < curWidth; ++x, prevX += 2) {
-                uint32_t value1 = (*r2)(prevX, prevY),
-                    value2 = (*r2)(prevX + 1, prevY),
-                    value3 = (*r2)(prevX, prevY + 1),
-                    value4 = (*r2)(prevX + 1, prevY + 1);
+                uint32_t value1 = r2(prevX, prevY),
+                    value2 = r2(prevX + 1, prevY),
+                    value3 = r2(prevX, prevY + 1),
+                    value4 = r2(prevX + 1, prevY + 1);
                 scaled[s](x, y) = (value1 + value2 + value3 + value4) >> 2;
             }
         }
-        r2 = &scaled[s];
     }
 }
 
@@ -24,25 +24,28 @@
 #define _IMAGE_H_
 
 #include <memory>
+#include <vector>
 
 #include <QString>
 
 #include <interpolation.h>
 
 #include "Array2D.hpp"
+#include "CompressedFrame.hpp"
 
 
 namespace hdrmerge {
 
 class RawParameters;
+class CFAPattern;
 
 class Image : public Array2D<uint16_t> {
 public:
     static const int scaleSteps = 6;
 
-    Image() : Array2D<uint16_t>() {}
+    Image() : Array2D<uint16_t>(), viewRows(0) {}
     Image(uint16_t * rawImage, const RawParameters & params, const QString& _filename) :
-        filename(_filename)
+        filename(_filename), viewRows(0)
     {
         buildImage(rawImage, params);
     }
@@ -58,6 +61,16 @@ public:
         return filename;
     }
 
+    /// Replaces the pixels with a CompressedFrame. Afterwards, they are read through views
+    void compress();
+    bool isCompressed() const {
+        return frame.get() != nullptr;
+    }
+    /// A view of a compressed image, with its parameters but no pixels until loadRows
+    Image view() const;
+    /// Decodes the rows of a view from y0 to y1, excluded, and the ones around them
+    void loadRows(int y0, int y1);
+
     bool good() const {
         return width > 0;
     }
@@ -77,6 +90,10 @@ public:
     double getRelativeExposure() const;
     size_t alignWith(const Image & r);
     void preScale();
+    /// Like preScale, but the first level only averages the green samples of a 2x2 pattern
+    void preScale(const CFAPattern & FC);
+    /// Positions of the two greens of a 2x2 pattern, bit py * 2 + px, or 0 for other patterns
+    static unsigned greenCells(const CFAPattern & FC);
     void releaseAlignData() {
         scaled.reset();
     }
@@ -109,8 +126,16 @@ private:
     ResponseFunction response;
     double halfLightPercent;
 
+    std::shared_ptr<const CompressedFrame> frame;
+    size_t viewRows; ///< Rows that fit in the pixel buffer of a view
+
     void subtractBlack(const RawParameters & params);
     void buildImage(uint16_t * rawImage, const RawParameters & params);
+    /// Builds the pyramid levels and halfLightPercent. The first level averages the samples of
+    /// each 2x2 cell at the positions set in cells, bit py * 2 + px, the rest halve the previous one.
+    void buildPyramid(unsigned cells);
+    /// Rows first to first + count of the pixel buffer, decoded into buffer if the image is compressed
+    const uint16_t * getRows(size_t first, size_t count, std::vector<uint16_t> & buffer) const;
 };
 
 } // namespace hdrmerge
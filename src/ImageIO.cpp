@@ -22,6 +22,7 @@
 
 #include <cstdlib>
 #include <algorithm>
+#include <future>
 #include <QImage>
 #include <QString>
 #include <QRegExp>
@@ -29,6 +30,8 @@
 #include <libraw.h>
 #include "ImageIO.hpp"
 #include "DngFloatWriter.hpp"
+#include "PreviewRenderer.hpp"
+#include "Threads.hpp"
 #include "Log.hpp"
 using namespace std;
 using namespace hdrmerge;
@@ -118,6 +121,9 @@ int ImageIO::load(const LoadOptions & options, ProgressIndicator & progress) {
                         failedImage = i;
                         break;
                     } else {
+                        if (options.compressFrames) {
+                            image.compress();
+                        }
                         int pos = stack.addImage(std::move(image));
                         rawParameters.emplace_back(std::move(params));
                         for (int j = rawParameters.size() - 1; j > pos; --j)
@@ -143,6 +149,9 @@ int ImageIO::load(const LoadOptions & options, ProgressIndicator & progress) {
                     failedImage = i;
                     break;
                 } else {
+                    if (options.compressFrames) {
+                        image.compress();
+                    }
                     int pos = stack.addImage(std::move(image));
                     rawParameters.emplace_back(std::move(params));
                     for (int j = rawParameters.size() - 1; j > pos; --j)
@@ -166,7 +175,12 @@ int ImageIO::load(const LoadOptions & options, ProgressIndicator & progress) {
         params.max = std::min(params.max, options.customWl);
     stack.calculateSaturationLevel(params, options.useCustomWl);
     if (options.align && params.canAlign()) {
-        stack.align();
+        bool alignGreen = options.alignGreen;
+        if (alignGreen && !Image::greenCells(params.FC)) {
+            Log::progress("Green alignment needs a 2x2 Bayer pattern, aligning on all the samples");
+            alignGreen = false;
+        }
+        stack.align(alignGreen ? &params.FC : nullptr);
         if (options.crop) {
             stack.crop();
         }
@@ -178,26 +192,173 @@ int ImageIO::load(const LoadOptions & options, ProgressIndicator & progress) {
 }
 
 
-void ImageIO::save(const SaveOptions & options, ProgressIndicator & progress) {
+template <typename T> Array2D<float> ImageIO::binRawData(const Array2D<T> & src, RawParameters & params, int factor) {
+    size_t periodX = params.FC.getColumns(), periodY = params.FC.getRows();
+    size_t width = params.width / (periodX * factor) * periodX;
+    size_t height = params.height / (periodY * factor) * periodY;
+    Array2D<float> dst(width, height);
+    const T * active = &src[params.topMargin * params.rawWidth + params.leftMargin];
+    float norm = 1.0f / (factor * factor);
+    #pragma omp parallel for schedule(dynamic,16)
+    for (size_t y = 0; y < height; ++y) {
+        size_t cy = y / periodY * factor, oy = y % periodY;
+        for (size_t x = 0; x < width; ++x) {
+            size_t cx = x / periodX * factor, ox = x % periodX;
+            float sum = 0.0f;
+            for (int j = 0; j < factor; ++j) {
+                const T * row = active + ((cy + j) * periodY + oy) * params.rawWidth;
+                for (int i = 0; i < factor; ++i) {
+                    sum += row[(cx + i) * periodX + ox];
+                }
+            }
+            dst(x, y) = sum * norm;
+        }
+    }
+    params.width = params.rawWidth = width;
+    params.height = params.rawHeight = height;
+    params.leftMargin = params.topMargin = 0;
+    return dst;
+}
+
+template Array2D<float> ImageIO::binRawData(const Array2D<float> & src, RawParameters & params, int factor);
+template Array2D<float> ImageIO::binRawData(const Array2D<HalfFloat> & src, RawParameters & params, int factor);
+
+
+template <typename T> void ImageIO::writeOutputs(const vector<SaveOptions> & outputs, size_t first, size_t last,
+        const RawParameters & params, Array2D<T> && composedImage,
+        future<Exif::Metadata> & metadata, Exif::Metadata & exif, ProgressIndicator & progress) {
+    if (metadata.valid()) {
+        exif = metadata.get();
+    }
+
+    progress.advance((100 * first + 33 * (last - first)) / outputs.size(), "Rendering preview");
+    // A single preview for all the outputs of this radius, the writer scales it down
+    int previewSize = 0;
+    for (size_t i = first; i < last; ++i) {
+        previewSize = std::max(previewSize, outputs[i].previewSize);
+    }
+    PreviewRenderer renderer(params, stack.getMaxExposure());
+    QImage preview;
+    if (previewSize == 0) {
+        // Only the thumbnail is needed
+        preview = renderer.renderThumbnail(composedImage, DngFloatWriter::thumbnailWidth);
+    } else {
+        preview = renderer.render(composedImage, previewSize == 1 ? 2 : 1);
+    }
+
+    progress.advance((100 * first + 66 * (last - first)) / outputs.size(), "Writing output");
+    for (size_t i = first; i < last; ++i) {
+        if (i + 1 < last) {
+            writeOutput(outputs[i], params, Array2D<T>(composedImage), preview, exif);
+        } else {
+            writeOutput(outputs[i], params, std::move(composedImage), preview, exif);
+        }
+    }
+}
+
+
+template <typename T> void ImageIO::writeOutput(const SaveOptions & options, const RawParameters & params, Array2D<T> && image,
+                          const QImage & preview, const Exif::Metadata & exif) {
     string cropped = stack.isCropped() ? " cropped" : "";
-    Log::msg(2, "Writing ", options.fileName, ", ", options.bps, "-bit, ", stack.getWidth(), 'x', stack.getHeight(), cropped);
+    string format = options.integerSamples ? "16-bit integer, " : to_string(options.bps) + "-bit, ";
+    Log::msg(2, "Writing ", options.fileName, ", ", format, stack.getWidth(), 'x', stack.getHeight(), cropped);
+
+    // The proxy is binned from the same composed image, before it is handed to the writer
+    RawParameters proxyParams = params;
+    Array2D<float> proxyImage;
+    if (options.saveProxy) {
+        int longEdge = std::max(params.width, params.height);
+        int factor = options.proxyLongEdge > 0 ? (longEdge + options.proxyLongEdge - 1) / options.proxyLongEdge : 2;
+        if (factor > 1) {
+            Timer t("Bin proxy");
+            proxyImage = binRawData(image, proxyParams, factor);
+        } else {
+            Log::progress("The proxy would not be smaller than the output, skipping it.");
+        }
+    }
+
+    // The opcode lists of the source use its coordinates, so they are dropped if the output is
+    // binned, cropped or has no margins
+    auto setupWriter = [&] (DngFloatWriter & writer, size_t width, bool sourceGeometry) {
+        writer.setBitsPerSample(options.bps);
+        writer.setIntegerSamples(options.integerSamples);
+        writer.setCompressionLevel(options.compressionLevel);
+        writer.setTileSize(options.tileWidth, options.tileLength);
+        writer.setPreviewWidth((options.previewSize * width) / 2);
+        writer.setPreview(preview);
+        Exif::Metadata metadata(exif);
+        if (!sourceGeometry) {
+            metadata.dropRawTags();
+        }
+        writer.setMetadata(std::move(metadata));
+    };
+    if (proxyImage.size() > 0) {
+        QString name = replaceArguments(options.proxyFileName, options.fileName);
+        Log::msg(2, "Writing proxy ", name, ", ", proxyParams.width, 'x', proxyParams.height);
+        DngFloatWriter writer;
+        setupWriter(writer, proxyParams.width, false);
+        writer.write(std::move(proxyImage), proxyParams, name);
+    }
+    DngFloatWriter writer;
+    setupWriter(writer, stack.getWidth(), !options.activeAreaOnly && !stack.isCropped());
+    writer.write(std::move(image), params, options.fileName);
+}
+
+
+void ImageIO::save(const SaveOptions & options, ProgressIndicator & progress) {
+    // The main output and its variants, sorted by feather radius so that each radius is composed only once
+    vector<SaveOptions> outputs(1, options);
+    outputs[0].variants.clear();
+    for (const SaveOptions::Variant & variant : options.variants) {
+        SaveOptions output = outputs[0];
+        if (variant.bps > 0) {
+            output.bps = variant.bps;
+            output.integerSamples = false;
+        }
+        if (variant.featherRadius >= 0) output.featherRadius = variant.featherRadius;
+        if (variant.previewSize >= 0) output.previewSize = variant.previewSize;
+        output.fileName = replaceArguments(variant.fileName, options.fileName);
+        output.saveProxy = output.saveMask = false;
+        outputs.push_back(output);
+    }
+    stable_sort(outputs.begin(), outputs.end(), [] (const SaveOptions & l, const SaveOptions & r) {
+        return l.featherRadius < r.featherRadius;
+    });
 
     progress.advance(0, "Rendering image");
     RawParameters params = *rawParameters.back();
     params.width = stack.getWidth();
     params.height = stack.getHeight();
-    params.adjustWhite(stack.getImage(stack.size() - 1));
-    Array2D<float> composedImage = stack.compose(params, options.featherRadius);
-
-    progress.advance(33, "Rendering preview");
-    QImage preview = renderPreview(composedImage, params, stack.getMaxExposure(), options.previewSize <= 1);
-
-    progress.advance(66, "Writing output");
-    DngFloatWriter writer;
-    writer.setBitsPerSample(options.bps);
-    writer.setPreviewWidth((options.previewSize * stack.getWidth()) / 2);
-    writer.setPreview(preview);
-    writer.write(std::move(composedImage), params, options.fileName);
+    const Image & darkest = stack.getImage(stack.size() - 1);
+    params.adjustWhite(darkest);
+    if (options.activeAreaOnly) {
+        // Compose and write just the active area, the black levels are already known
+        params.rawWidth = params.width;
+        params.rawHeight = params.height;
+        params.leftMargin = params.topMargin = 0;
+    }
+    // Read the metadata of the source file while composing
+    future<Exif::Metadata> metadata = async(launch::async, [&] () {
+        Threads::unpin();
+        return Exif::Metadata(params.fileName);
+    });
+    Exif::Metadata exif;
+
+    for (size_t first = 0, last; first < outputs.size(); first = last) {
+        for (last = first + 1; last < outputs.size() && outputs[last].featherRadius == outputs[first].featherRadius; ++last);
+        progress.advance((100 * first) / outputs.size(), "Rendering image");
+        // Compose straight to half precision if no output of this radius needs more
+        bool half = all_of(outputs.begin() + first, outputs.begin() + last, [] (const SaveOptions & o) {
+            return o.bps == 16 && !o.integerSamples;
+        });
+        if (half) {
+            Array2D<HalfFloat> composedImage = stack.composeHalf(params, outputs[first].featherRadius, options.featherSamples);
+            writeOutputs(outputs, first, last, params, std::move(composedImage), metadata, exif, progress);
+        } else {
+            Array2D<float> composedImage = stack.compose(params, outputs[first].featherRadius, options.featherSamples);
+            writeOutputs(outputs, first, last, params, std::move(composedImage), metadata, exif, progress);
+        }
+    }
     progress.advance(100, "Done writing!");
 
     if (options.saveMask) {
@@ -217,10 +378,8 @@ void ImageIO::writeMaskImage(const QString & maskFile) {
         maskImage.setColor(c, qRgb(gray, gray, gray));
     }
     maskImage.setColor(numColors, qRgb(255, 255, 255));
-    for (size_t y = 0, pos = 0; y < mask.getHeight(); ++y) {
-        for (size_t x = 0; x < mask.getWidth(); ++x, ++pos) {
-            maskImage.setPixel(x, y, mask[pos]);
-        }
+    for (size_t y = 0; y < mask.getHeight(); ++y) {
+        mask.getRow(y, maskImage.scanLine(y));
     }
     if (!maskImage.save(maskFile)) {
         Log::progress("Cannot save mask image to ", maskFile);
@@ -228,78 +387,8 @@ void ImageIO::writeMaskImage(const QString & maskFile) {
 }
 
 
-static void prepareRawBuffer(LibRaw & rawProcessor) {
-    rawProcessor.imgdata.progress_flags |= LIBRAW_PROGRESS_LOAD_RAW;
-    auto & i = rawProcessor.imgdata;
-    auto & r = i.rawdata;
-    auto & s = i.sizes;
-    r.color4_image = nullptr;
-    r.color3_image = nullptr;
-    size_t numPixels = s.raw_width * (s.raw_height + 7);
-    r.raw_alloc = std::malloc(numPixels * sizeof(ushort));
-    r.raw_image = (ushort*) r.raw_alloc;
-    s.raw_pitch = s.raw_width*2;
-    copy_n(&i.color, 1, &r.color);
-    copy_n(&i.sizes, 1, &r.sizes);
-    copy_n(&i.idata, 1, &r.iparams);
-}
-
-
 QImage ImageIO::renderPreview(const Array2D<float> & rawData, const RawParameters & params, float expShift, bool halfSize) {
-    Timer t("Render preview");
-    std::unique_ptr<LibRaw> rawProcessor(new LibRaw);
-    auto & d = rawProcessor->imgdata;
-    d.params.user_sat = 65535;
-    d.params.user_black = 0;
-    for (int c = 0; c < 4; ++c) {
-        d.params.user_cblack[c] = 0;
-    }
-    d.params.highlight = 2;
-    d.params.user_qual = 3;
-    d.params.med_passes = 0;
-    copy_n(params.camMul, 4, d.params.user_mul);
-    d.params.user_flip = 0;
-    d.params.exp_correc = 1;
-    d.params.exp_shift = expShift;
-    d.params.exp_preser = 1.0;
-    d.params.half_size = halfSize ? 1 : 0; // much faster, will be used for preview size 'half' or 'none'
-    if (rawProcessor->open_file(params.fileName.toLocal8Bit().constData()) == LIBRAW_SUCCESS) {
-//             && rawProcessor.unpack() == LIBRAW_SUCCESS) {
-        prepareRawBuffer(*(rawProcessor.get()));
-        // Assume the other sizes are the same as in the raw parameters
-        d.sizes.width = params.width;
-        d.sizes.height = params.height;
-        float scale = d.params.user_sat / (float)(params.max - params.black);
-        for (size_t y = 0; y < params.rawHeight; ++y) {
-            for (size_t x = 0; x < params.rawWidth; ++x) {
-                size_t pos = y*params.rawWidth + x;
-                int v = (rawData[pos] - params.blackAt(x - params.leftMargin, y - params.topMargin)) * scale;
-                if (v < 0) v = 0;
-                else if (v > 65535) v = 65535;
-                d.rawdata.raw_image[pos] = v;
-            }
-        }
-        rawProcessor->dcraw_process();
-        libraw_processed_image_t * image = rawProcessor->dcraw_make_mem_image();
-        if (image == nullptr) {
-            Log::msg(2, "dcraw_make_mem_image() returned NULL");
-        } else {
-            QImage interpolated(image->width, image->height, QImage::Format_RGB32);
-            if (interpolated.isNull()) return QImage();
-            for (int y = 0; y < image->height; ++y) {
-                QRgb* scanline = (QRgb*)interpolated.scanLine(y);
-                int pos = (y*image->width)*3;
-                for (int x = 0; x < image->width; ++x) {
-                    int r = image->data[pos++], g = image->data[pos++], b = image->data[pos++];
-                    scanline[x] = qRgb(r, g, b);
-                }
-            }
-            LibRaw::dcraw_clear_mem(image);
-            // The result may be some pixels bigger than the original...
-            return interpolated.copy(0, 0, params.width/(halfSize ? 2 : 1 ), params.height/(halfSize ? 2 : 1 ));
-        }
-    }
-    return QImage();
+    return PreviewRenderer(params, expShift).render(rawData, halfSize ? 2 : 1);
 }
 
 
@@ -23,6 +23,7 @@
 #ifndef _IMAGEIO_H_
 #define _IMAGEIO_H_
 
+#include <future>
 #include <vector>
 #include <QImage>
 #include <QDateTime>
@@ -31,6 +32,7 @@
 #include "ProgressIndicator.hpp"
 #include "LoadSaveOptions.hpp"
 #include "RawParameters.hpp"
+#include "ExifTransfer.hpp"
 
 namespace hdrmerge {
 
@@ -53,6 +55,9 @@ public:
     QString replaceArguments(const QString & pattern, const QString & outFileName) const;
     static int getFrameCount(RawParameters & rawParameters) ;
     static Image loadRawImage(const QString& filename, RawParameters & rawParameters, int shot_select = 0);
+    /// Averages each CFA position over blocks of factor x factor CFA periods of the active area,
+    /// so that the result keeps the same pattern. Updates the sizes in params.
+    template <typename T> static Array2D<float> binRawData(const Array2D<T> & src, RawParameters & params, int factor);
     static QImage renderPreview(const Array2D<float> & rawData, const RawParameters & rawParameters, float expShift, bool halfsize = false);
 
     struct QDateInterval {
@@ -70,6 +75,11 @@ private:
     ImageStack stack;
     std::vector<std::unique_ptr<RawParameters>> rawParameters;
 
+    template <typename T> void writeOutputs(const std::vector<SaveOptions> & outputs, size_t first, size_t last,
+        const RawParameters & params, Array2D<T> && composedImage,
+        std::future<Exif::Metadata> & metadata, Exif::Metadata & exif, ProgressIndicator & progress);
+    template <typename T> void writeOutput(const SaveOptions & options, const RawParameters & params, Array2D<T> && image,
+                                           const QImage & preview, const Exif::Metadata & exif);
     void writeMaskImage(const QString & maskFile);
 };
 
@@ -21,16 +21,14 @@
  */
 
 #include <algorithm>
+#include <functional>
 
-#include "BoxBlur.hpp"
+#include "BlendMap.hpp"
+#include "CFALookup.hpp"
 #include "ImageStack.hpp"
 #include "Log.hpp"
 #include "RawParameters.hpp"
 
-#ifdef __SSE2__
-    #include <x86intrin.h>
-#endif
-
 using namespace std;
 using namespace hdrmerge;
 
@@ -50,44 +48,95 @@ int ImageStack::addImage(Image && i) {
 }
 
 
-void ImageStack::calculateSaturationLevel(const RawParameters & params, bool useCustomWl) {
-    // Calculate max value of brightest image and assume it is saturated
-    Image& brightest = images.front();
+namespace {
 
-    std::vector<std::vector<size_t>> histograms(4, std::vector<size_t>(brightest.getMax() + 1));
+// The images of a stack, through views that decode the rows of a band when they are compressed
+class ImageRows {
+public:
+    explicit ImageRows(const std::vector<Image> & images) : compressed(false) {
+        views.reserve(images.size());
+        for (auto & i : images) {
+            views.push_back(i.isCompressed() ? i.view() : Image());
+            compressed = compressed || i.isCompressed();
+        }
+        for (size_t i = 0; i < images.size(); ++i) {
+            pointers.push_back(images[i].isCompressed() ? &views[i] : &images[i]);
+        }
+    }
 
-    #pragma omp parallel
-    {
-        std::vector<std::vector<size_t>> histogramsThr(4, std::vector<size_t>(brightest.getMax() + 1));
-        #pragma omp for schedule(dynamic,16) nowait
-        for (size_t y = 0; y < height; ++y) {
-            // get the color codes from x = 0 to 5, works for bayer and xtrans
-            uint16_t fcrow[6];
-            for (size_t i = 0; i < 6; ++i) {
-                fcrow[i] = params.FC(i, y);
-            }
-            size_t x = 0;
-            for (; x < width - 5; x+=6) {
-                for(size_t j = 0; j < 6; ++j) {
-                    uint16_t v = brightest(x + j, y);
-                    ++histogramsThr[fcrow[j]][v];
-                }
-            }
-            // remaining pixels
-            for (size_t j = 0; x < width; ++x, ++j) {
-                uint16_t v = brightest(x, y);
-                ++histogramsThr[fcrow[j]][v];
+    /// Makes rows y0 to y1, excluded, readable in all the images
+    void load(size_t y0, size_t y1) {
+        if (compressed) {
+            for (auto & v : views) {
+                if (v.isCompressed()) v.loadRows(y0, y1);
             }
         }
-        #pragma omp critical
+    }
+    const Image & operator[](size_t i) const {
+        return *pointers[i];
+    }
+
+private:
+    std::vector<Image> views;
+    std::vector<const Image *> pointers;
+    bool compressed;
+};
+
+
+// Adds the values of each color of image to its histogram
+struct ColorHistograms {
+    const Image & image;
+    size_t width, height;
+    std::vector<std::vector<size_t>> & histograms;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        // By bands, which a compressed image decodes into a view
+        const size_t bandRows = CompressedFrame::stripRows;
+        #pragma omp parallel
         {
-            for (int c = 0; c < 4; ++c) {
-                for (std::vector<size_t>::size_type i = 0; i < histograms[c].size(); ++i) {
-                    histograms[c][i] += histogramsThr[c][i];
+            std::vector<std::vector<size_t>> histogramsThr(4, std::vector<size_t>(histograms[0].size()));
+            Image view = image.isCompressed() ? image.view() : Image();
+            const Image & src = image.isCompressed() ? view : image;
+            // Static, see generateMask
+            #pragma omp for schedule(static) nowait
+            for (size_t y0 = 0; y0 < height; y0 += bandRows) {
+                size_t y1 = std::min(y0 + bandRows, height);
+                if (image.isCompressed()) view.loadRows(y0, y1);
+                for (size_t y = y0; y < y1; ++y) {
+                    const typename CFA::Row & row = cfa.row(y);
+                    size_t x = 0;
+                    for (; x + CFA::columns <= width; x += CFA::columns) {
+                        for (int j = 0; j < CFA::columns; ++j) {
+                            ++histogramsThr[row.color[j]][src(x + j, y)];
+                        }
+                    }
+                    // remaining pixels
+                    for (size_t j = 0; x < width; ++x, ++j) {
+                        ++histogramsThr[row.color[j]][src(x, y)];
+                    }
+                }
+            }
+            #pragma omp critical
+            {
+                for (int c = 0; c < 4; ++c) {
+                    for (std::vector<size_t>::size_type i = 0; i < histograms[c].size(); ++i) {
+                        histograms[c][i] += histogramsThr[c][i];
+                    }
                 }
             }
         }
     }
+};
+
+} // namespace
+
+
+void ImageStack::calculateSaturationLevel(const RawParameters & params, bool useCustomWl) {
+    // Calculate max value of brightest image and assume it is saturated
+    const Image & brightest = images.front();
+
+    std::vector<std::vector<size_t>> histograms(4, std::vector<size_t>(brightest.getMax() + 1));
+    dispatchCFA(params, ColorHistograms{brightest, width, height, histograms});
 
     const size_t threshold = width * height / 10000;
 
@@ -123,13 +172,17 @@ void ImageStack::calculateSaturationLevel(const RawParameters & params, bool use
 }
 
 
-void ImageStack::align() {
+void ImageStack::align(const CFAPattern * FC) {
     if (images.size() > 1) {
         Timer t("Align");
         size_t errors[images.size()];
         #pragma omp parallel for schedule(dynamic)
         for (size_t i = 0; i < images.size(); ++i) {
-            images[i].preScale();
+            if (FC) {
+                images[i].preScale(*FC);
+            } else {
+                images[i].preScale();
+            }
         }
         #pragma omp parallel for schedule(dynamic)
         for (size_t i = 0; i < images.size() - 1; ++i) {
@@ -174,26 +227,39 @@ void ImageStack::computeResponseFunctions() {
 
 void ImageStack::generateMask() {
     Timer t("Generate mask");
+    // A single image leaves the mask filled with zeroes
     mask.resize(width, height);
-    if(images.size() == 1) {
-        // single image, fill in zero values
-        std::fill_n(&mask[0], width*height, 0);
-    } else {
-        // multiple images, no need to prefill mask with zeroes. It will be filled correctly on the fly
-        #pragma omp parallel for schedule(dynamic)
-        for (size_t y = 0; y < height; ++y) {
-            for (size_t x = 0; x < width; ++x) {
-                size_t i = 0;
-                while (i < images.size() - 1 &&
-                    (!images[i].contains(x, y) ||
-                    images[i].isSaturatedAround(x, y))) ++i;
-                mask(x, y) = i;
+    if (images.size() > 1) {
+        // Computed by strips of tiles, so that the full mask is never stored a byte per pixel
+        size_t strips = (height + TiledMask::tileSize - 1) / TiledMask::tileSize;
+        #pragma omp parallel
+        {
+            unique_ptr<uint8_t[]> strip(new uint8_t[width * TiledMask::tileSize]);
+            ImageRows frames(images);
+            // Static, like the first touch of the buffers, so that each thread reads the rows of its node
+            #pragma omp for schedule(static)
+            for (size_t s = 0; s < strips; ++s) {
+                size_t y0 = s * TiledMask::tileSize, y1 = std::min(y0 + TiledMask::tileSize, height);
+                frames.load(y0, y1);
+                for (size_t y = y0; y < y1; ++y) {
+                    uint8_t * row = &strip[(y - y0) * width];
+                    for (size_t x = 0; x < width; ++x) {
+                        size_t i = 0;
+                        while (i < images.size() - 1 &&
+                            (!frames[i].contains(x, y) ||
+                            frames[i].isSaturatedAround(x, y))) ++i;
+                        row[x] = i;
+                    }
+                }
+                mask.setStrip(s, strip.get());
             }
         }
     }
     // The mask can be used in compose to get the information about saturated pixels
-    // but the mask can be modified in gui, so we have to make a copy to represent the original state
+    // but the mask can be modified in gui, so we keep a copy of the original state.
+    // It shares all the tiles with the mask until they are edited.
     origMask = mask;
+    Log::debug("Mask size ", mask.memoryUsage() / 1024, "KB");
 }
 
 
@@ -202,271 +268,185 @@ double ImageStack::value(size_t x, size_t y) const {
     return img.exposureAt(x, y);
 }
 
-#ifndef __SSE2__
-// From The GIMP: app/paint-funcs/paint-funcs.c:fatten_region
-static Array2D<uint8_t> fattenMask(const Array2D<uint8_t> & mask, int radius) {
-    Timer t("Fatten mask");
-    size_t width = mask.getWidth(), height = mask.getHeight();
-    Array2D<uint8_t> result(width, height);
-
-    int circArray[2 * radius + 1]; // holds the y coords of the filter's mask
-    // compute_border(circArray, radius)
-    for (int i = 0; i < radius * 2 + 1; i++) {
-        double tmp;
-        if (i > radius)
-            tmp = (i - radius) - 0.5;
-        else if (i < radius)
-            tmp = (radius - i) - 0.5;
-        else
-            tmp = 0.0;
-        circArray[i] = int(std::sqrt(radius*radius - tmp*tmp));
+namespace {
+
+// Scales a row of the blend by mult and adds back the black levels, converting it to T. The row
+// covers the width pixels of the active area, the margins and a null row are black.
+template <typename T, typename CFA> void restoreBlackRow(const CFA & cfa, const RawParameters & params, size_t width,
+                                                         size_t y, const float * row, float mult, T * dst) {
+    const typename CFA::Row & blacks = cfa.row((int)y - (int)params.topMargin);
+    size_t x0 = row ? params.leftMargin : params.rawWidth, x1 = std::min(x0 + width, params.rawWidth);
+    for (size_t x = 0, c = CFA::column(-(int)params.leftMargin); x < params.rawWidth; ++x) {
+        float v = x >= x0 && x < x1 ? row[x - x0] : 0.0f;
+        v *= mult;
+        v += blacks.black[c];
+        dst[x] = T(v);
+        if (++c == CFA::columns) c = 0;
     }
-    // offset the circ pointer by radius so the range of the array
-    //     is [-radius] to [radius]
-    int * circ = circArray + radius;
+}
 
-    const uint8_t * bufArray[height + 2*radius];
-    for (int i = 0; i < radius; i++) {
-        bufArray[i] = &mask[0];
-    }
-    for (size_t i = 0; i < height; i++) {
-        bufArray[i + radius] = &mask[i * width];
-    }
-    for (int i = 0; i < radius; i++) {
-        bufArray[i + height + radius] = &mask[(height - 1) * width];
-    }
-    // offset the buf pointer
-    const uint8_t ** buf = bufArray + radius;
-
-    #pragma omp parallel
-    {
-        unique_ptr<uint8_t[]> buffer(new uint8_t[width * (radius + 1)]);
-        unique_ptr<uint8_t *[]> maxArray;  // caches the largest values for each column
-        maxArray.reset(new uint8_t *[width + 2 * radius]);
-        for (int i = 0; i < radius; i++) {
-            maxArray[i] = buffer.get();
-        }
-        for (size_t i = 0; i < width; i++) {
-            maxArray[i + radius] = &buffer[(radius + 1) * i];
-        }
-        for (int i = 0; i < radius; i++) {
-            maxArray[i + width + radius] = &buffer[(radius + 1) * (width - 1)];
-        }
-        // offset the max pointer
-        uint8_t ** max = maxArray.get() + radius;
-
-        #pragma omp for schedule(dynamic)
-        for (size_t y = 0; y < height; y++) {
-            uint8_t rowMax = 0;
-            for (size_t x = 0; x < width; x++) { // compute max array
-                max[x][0] = buf[y][x];
-                for (int i = 1; i <= radius; i++) {
-                    max[x][i] = std::max(std::max(max[x][i - 1], buf[y + i][x]), buf[y - i][x]);
-                    rowMax = std::max(max[x][i], rowMax);
-                }
-            }
 
-            uint8_t last_max = max[0][circ[-1]];
-            int last_index = 1;
-            for (size_t x = 0; x < width; x++) { // render scan line
-                last_index--;
-                if (last_index >= 0) {
-                    if (last_max == rowMax) {
-                        result(x, y) = rowMax;
-                    } else {
-                        last_max = 0;
-                        for (int i = radius; i >= 0; i--)
-                            if (last_max < max[x + i][circ[i]]) {
-                                last_max = max[x + i][circ[i]];
-                                last_index = i;
-                            }
-                        result(x, y) = last_max;
-                    }
-                } else {
-                    last_index = radius;
-                    last_max = max[x + radius][circ[radius]];
-
-                    for (int i = radius - 1; i >= -radius; i--)
-                        if (last_max < max[x + i][circ[i]]) {
-                            last_max = max[x + i][circ[i]];
-                            last_index = i;
-                        }
-                    result(x, y) = last_max;
-                }
+// Scales the blended image in place, see restoreBlackRow
+struct RestoreBlack {
+    Array2D<float> & image;
+    size_t width, height;
+    float mult;
+    const RawParameters & params;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        #pragma omp parallel for
+        for (size_t y = 0; y < params.rawHeight; ++y) {
+            bool active = y >= params.topMargin && y < params.topMargin + height;
+            const float * row = active ? &image(params.leftMargin, y) : nullptr;
+            restoreBlackRow(cfa, params, width, y, row, mult, &image(0, y));
+        }
+    }
+};
+
+
+// Fills the black rows of the margins of a half precision image, and sets store to scale and round the
+// rows of the blend into it
+struct HalfStore {
+    Array2D<HalfFloat> & image;
+    size_t width, height;
+    float mult;
+    const RawParameters & params;
+    std::function<void(size_t, const float *)> & store;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        #pragma omp parallel for
+        for (size_t y = 0; y < params.rawHeight; ++y) {
+            if (y < params.topMargin || y >= params.topMargin + height) {
+                restoreBlackRow(cfa, params, width, y, (const float *)nullptr, mult, &image(0, y));
             }
         }
+        Array2D<HalfFloat> & dst = image;
+        const RawParameters & p = params;
+        size_t w = width;
+        float m = mult;
+        store = [cfa, &dst, &p, w, m] (size_t y, const float * row) {
+            restoreBlackRow(cfa, p, w, y + p.topMargin, row, m, &dst(0, y + p.topMargin));
+        };
     }
+};
 
-    return result;
-}
-#else // use faster SSE version, crunch 16 bytes at once
-// From The GIMP: app/paint-funcs/paint-funcs.c:fatten_region
-// SSE version by Ingo Weyrich
-static Array2D<uint8_t> fattenMask(const Array2D<uint8_t> & mask, int radius) {
-    Timer t("Fatten mask (SSE version)");
-    size_t width = mask.getWidth(), height = mask.getHeight();
-    Array2D<uint8_t> result(width, height);
-
-    int circArray[2 * radius + 1]; // holds the y coords of the filter's mask
-    // compute_border(circArray, radius)
-    for (int i = 0; i < radius * 2 + 1; i++) {
-        double tmp;
-        if (i > radius)
-            tmp = (i - radius) - 0.5;
-        else if (i < radius)
-            tmp = (radius - i) - 0.5;
-        else
-            tmp = 0.0;
-        circArray[i] = int(std::sqrt(radius*radius - tmp*tmp));
-    }
-    // offset the circ pointer by radius so the range of the array
-    //     is [-radius] to [radius]
-    int * circ = circArray + radius;
+} // namespace
 
-    const uint8_t * bufArray[height + 2*radius];
-    for (int i = 0; i < radius; i++) {
-        bufArray[i] = &mask[0];
-    }
-    for (size_t i = 0; i < height; i++) {
-        bufArray[i + radius] = &mask[i * width];
-    }
-    for (int i = 0; i < radius; i++) {
-        bufArray[i + height + radius] = &mask[(height - 1) * width];
-    }
-    // offset the buf pointer
-    const uint8_t ** buf = bufArray + radius;
-
-    #pragma omp parallel
-    {
-        uint8_t buffer[width * (radius + 1)];
-        uint8_t *maxArray[radius+1];
-        for (int i = 0; i <= radius; i++) {
-            maxArray[i] = &buffer[i*width];
-        }
 
-        #pragma omp for schedule(dynamic,16)
-        for (size_t y = 0; y < height; y++) {
-            size_t x = 0;
-            for (; x < width-15; x+=16) { // compute max array, use SSE to process 16 bytes at once
-                __m128i lmax = _mm_loadu_si128((__m128i*)&buf[y][x]);
-                if(radius<2) // max[0] is only used when radius < 2
-                    _mm_storeu_si128((__m128i*)&maxArray[0][x],lmax);
-                for (int i = 1; i <= radius; i++) {
-                    lmax = _mm_max_epu8(_mm_loadu_si128((__m128i*)&buf[y + i][x]),lmax);
-                    lmax = _mm_max_epu8(_mm_loadu_si128((__m128i*)&buf[y - i][x]),lmax);
-                    _mm_storeu_si128((__m128i*)&maxArray[i][x],lmax);
-                }
-            }
-            for (; x < width; x++) { // compute max array, remaining columns
-                uint8_t lmax = buf[y][x];
-                if(radius<2) // max[0] is only used when radius < 2
-                    maxArray[0][x] = lmax;
-                for (int i = 1; i <= radius; i++) {
-                    lmax = std::max(std::max(lmax, buf[y + i][x]), buf[y - i][x]);
-                    maxArray[i][x] = lmax;
-                }
-            }
+Array2D<float> ImageStack::compose(const RawParameters & params, int featherRadius, int featherSamples) const {
+    BlendMap map(mask, featherRadius, BlendMap::factorFor(featherRadius, featherSamples));
+    Timer t("Compose");
+    Array2D<float> dst(params.rawWidth, params.rawHeight);
+    float max = blend(params, map, [&] (size_t y, const float * row) {
+        std::copy_n(row, width, &dst(params.leftMargin, y + params.topMargin));
+    });
+    // Scale to params.max and recover the black levels
+    float mult = (params.max - params.maxBlack) / max;
+    dispatchCFA(params, RestoreBlack{dst, width, height, mult, params});
 
-            for (x = 0; (int)x < radius; x++) { // render scan line, first columns without SSE
-                uint8_t last_max = maxArray[circ[radius]][x+radius];
-                for (int i = radius - 1; i >= -(int)x; i--)
-                    last_max = std::max(last_max,maxArray[circ[i]][x + i]);
-                result(x, y) = last_max;
-            }
-            for (; x < width-15-radius+1; x += 16) { // render scan line, use SSE to process 16 bytes at once
-                __m128i last_maxv = _mm_loadu_si128((__m128i*)&maxArray[circ[radius]][x+radius]);
-                for (int i = radius - 1; i >= -radius; i--)
-                    last_maxv = _mm_max_epu8(last_maxv,_mm_loadu_si128((__m128i*)&maxArray[circ[i]][x+i]));
-                _mm_storeu_si128((__m128i*)&result(x,y),last_maxv);
-            }
+    return dst;
+}
 
-            for (; x < width; x++) { // render scan line, last columns without SSE
-                int maxRadius = std::min(radius,(int)((int)width-1-(int)x));
-                uint8_t last_max = maxArray[circ[maxRadius]][x+maxRadius];
-                for (int i = maxRadius-1; i >= -radius; i--)
-                    last_max = std::max(last_max,maxArray[circ[i]][x + i]);
-                result(x, y) = last_max;
-            }
-        }
-    }
 
-    return result;
+Array2D<HalfFloat> ImageStack::composeHalf(const RawParameters & params, int featherRadius, int featherSamples) const {
+    BlendMap map(mask, featherRadius, BlendMap::factorFor(featherRadius, featherSamples));
+    Timer t("Compose");
+    // Rows are scaled as they are blended, so the maximum is found first by a pass that stores nothing
+    float max = blend(params, map, RowStore());
+    Array2D<HalfFloat> dst(params.rawWidth, params.rawHeight);
+    // Same as compose, with the rounding of DngFloatWriter
+    float mult = (params.max - params.maxBlack) / max;
+    RowStore store;
+    dispatchCFA(params, HalfStore{dst, width, height, mult, params, store});
+    blend(params, map, store);
+
+    return dst;
 }
-#endif
 
-Array2D<float> ImageStack::compose(const RawParameters & params, int featherRadius) const {
-    int imageMax = images.size() - 1;
-    BoxBlur map(fattenMask(mask, featherRadius));
-    measureTime("Blur", [&] () {
-        map.blur(featherRadius);
-    });
-    Timer t("Compose");
-    Array2D<float> dst(params.rawWidth, params.rawHeight);
-    dst.displace(-(int)params.leftMargin, -(int)params.topMargin);
-    dst.fillBorders(0.f);
 
-    float max = 0.0;
-    double saturatedRange = params.max - satThreshold;
-    #pragma omp parallel
-    {
-        float maxthr = 0.0;
-        #pragma omp for schedule(dynamic,16) nowait
-        for (size_t y = 0; y < height; ++y) {
-            for (size_t x = 0; x < width; ++x) {
-                double v, vv;
-                double p = map(x,y);
-                p = p < 0.0 ? 0.0 : p;
-                int j = p;
-                if (images[j].contains(x, y)) {
-                    p = p - j;
-                    v = images[j].exposureAt(x, y);
-                    // Adjust false highlights
-                    if (j < origMask(x,y)) { // SaturatedAround
-                        v /= params.whiteMultAt(x, y);
-                        if(p > 0.0001) {
-                            uint16_t rawV = images[j].getMaxAround(x, y);
-                            double k = (rawV - satThreshold) / saturatedRange;
-                            if (k > 1.0)
-                                k = 1.0;
-                            p += (1.0 - p) * k;
+// Blends the rows of the images, with the white multipliers of the pattern type CFA
+struct ImageStack::BlendKernel {
+    const ImageStack & stack;
+    const BlendMap & map;
+    const RowStore & store;
+    double saturatedRange;
+    float & max;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        int imageMax = stack.images.size() - 1;
+        // By bands, which compressed images decode at once
+        const size_t bandRows = CompressedFrame::stripRows;
+        #pragma omp parallel
+        {
+            float maxthr = 0.0;
+            unique_ptr<float[]> buffer(new float[stack.width]);
+            unique_ptr<uint8_t[]> origRow(new uint8_t[stack.width]);
+            unique_ptr<float[]> out(new float[stack.width]);
+            ImageRows frames(stack.images);
+            // Static, see generateMask
+            #pragma omp for schedule(static) nowait
+            for (size_t y0 = 0; y0 < stack.height; y0 += bandRows) {
+                size_t y1 = std::min(y0 + bandRows, stack.height);
+                frames.load(y0, y1);
+                for (size_t y = y0; y < y1; ++y) {
+                    const float * mapRow = map.getRow(y, buffer.get());
+                    const typename CFA::Row & row = cfa.row(y);
+                    stack.origMask.getRow(y, origRow.get());
+                    for (size_t x = 0; x < stack.width; ++x) {
+                        double v, vv;
+                        double p = mapRow[x];
+                        p = p < 0.0 ? 0.0 : p;
+                        int j = p;
+                        if (frames[j].contains(x, y)) {
+                            p = p - j;
+                            v = frames[j].exposureAt(x, y);
+                            // Adjust false highlights
+                            if (j < origRow[x]) { // SaturatedAround
+                                v /= row.whiteMult[x % CFA::columns];
+                                if(p > 0.0001) {
+                                    uint16_t rawV = frames[j].getMaxAround(x, y);
+                                    double k = (rawV - stack.satThreshold) / saturatedRange;
+                                    if (k > 1.0)
+                                        k = 1.0;
+                                    p += (1.0 - p) * k;
+                                }
+                            }
+                        } else {
+                            v = 0.0;
+                            p = 1.0;
+                        }
+                        if (p > 0.0001 && j < imageMax && frames[j + 1].contains(x, y)) {
+                            vv = frames[j + 1].exposureAt(x, y);
+                            if (j + 1 < origRow[x]) { // SaturatedAround
+                                vv /= row.whiteMult[x % CFA::columns];
+                            }
+                        } else {
+                            vv = 0.0;
+                            p = 0.0;
+                        }
+                        v -= p * (v - vv);
+                        out[x] = v;
+                        if (v > maxthr) {
+                            maxthr = v;
                         }
                     }
-                } else {
-                    v = 0.0;
-                    p = 1.0;
-                }
-                if (p > 0.0001 && j < imageMax && images[j + 1].contains(x, y)) {
-                    vv = images[j + 1].exposureAt(x, y);
-                    if (j + 1 < origMask(x,y)) { // SaturatedAround
-                        vv /= params.whiteMultAt(x, y);
+                    if (store) {
+                        store(y, out.get());
                     }
-                } else {
-                    vv = 0.0;
-                    p = 0.0;
-                }
-                v -= p * (v - vv);
-                dst(x, y) = v;
-                if (v > maxthr) {
-                    maxthr = v;
                 }
             }
-        }
-        #pragma omp critical
-        if (maxthr > max) {
-            max = maxthr;
+            #pragma omp critical
+            if (maxthr > max) {
+                max = maxthr;
+            }
         }
     }
+};
 
-    dst.displace(params.leftMargin, params.topMargin);
-    // Scale to params.max and recover the black levels
-    float mult = (params.max - params.maxBlack) / max;
-    #pragma omp parallel for
-    for (size_t y = 0; y < params.rawHeight; ++y) {
-        for (size_t x = 0; x < params.rawWidth; ++x) {
-            dst(x, y) *= mult;
-            dst(x, y) += params.blackAt(x - params.leftMargin, y - params.topMargin);
-        }
-    }
 
-    return dst;
+float ImageStack::blend(const RawParameters & params, const BlendMap & map, const RowStore & store) const {
+    float max = 0.0;
+    double saturatedRange = params.max - satThreshold;
+    dispatchCFA(params, BlendKernel{*this, map, store, saturatedRange, max});
+    return max;
 }
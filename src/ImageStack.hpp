@@ -23,17 +23,21 @@
 #ifndef _IMAGESTACK_H_
 #define _IMAGESTACK_H_
 
+#include <functional>
 #include <vector>
 #include <string>
 #include <memory>
 #include <cmath>
 #include "Image.hpp"
 #include "Array2D.hpp"
+#include "HalfFloat.hpp"
 #include "EditableMask.hpp"
 #include "LoadSaveOptions.hpp"
 
 namespace hdrmerge {
 
+class BlendMap;
+
 class ImageStack {
 public:
     ImageStack() : mask(this), width(0), height(0), flip(0) {}
@@ -44,11 +48,16 @@ public:
     }
 
     int addImage(Image && i);
-    void align();
+    /// Aligns the images, on the green samples of FC when it is given
+    void align(const CFAPattern * FC = nullptr);
     void crop();
     void computeResponseFunctions();
     void generateMask();
-    Array2D<float> compose(const RawParameters & md, int featherRadius) const;
+    /// The blend map is blurred at a reduced resolution that keeps at least featherSamples
+    /// pixels per feather radius, and upsampled row by row; 0 blurs it at full resolution.
+    Array2D<float> compose(const RawParameters & md, int featherRadius, int featherSamples = 0) const;
+    /// Same as compose, rounded to half precision as in a 16-bit DNG file, without keeping the floats
+    Array2D<HalfFloat> composeHalf(const RawParameters & md, int featherRadius, int featherSamples = 0) const;
 
     size_t size() const { return images.size(); }
 
@@ -104,11 +113,19 @@ private:
 
     std::vector<Image> images;   ///< Images, from most to least exposed
     EditableMaskImpl mask;
-    Array2D<uint8_t> origMask;
+    TiledMask origMask; ///< Shares the tiles that the user did not edit with mask
     size_t width;
     size_t height;
     int flip;
     uint16_t satThreshold;
+
+    /// Receives row y of the active area of the blend
+    typedef std::function<void(size_t y, const float * row)> RowStore;
+    struct BlendKernel;
+
+    /// Blends the images with map, passing each row to store if it is set. The rows are not
+    /// scaled, returns their maximum value
+    float blend(const RawParameters & params, const BlendMap & map, const RowStore & store) const;
 };
 
 } // namespace hdrmerge
@@ -22,6 +22,8 @@
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <stdexcept>
 #include <string>
 #include <QApplication>
 #include <QTranslator>
@@ -29,6 +31,11 @@
 #include <QLocale>
 #include "Launcher.hpp"
 #include "ImageIO.hpp"
+#include "CpuFeatures.hpp"
+#include "BufferAllocator.hpp"
+#include "BufferPool.hpp"
+#include "CompressedFrame.hpp"
+#include "Threads.hpp"
 #ifndef NO_GUI
 #include "MainWindow.hpp"
 #endif
@@ -39,7 +46,7 @@ using namespace std;
 
 namespace hdrmerge {
 
-Launcher::Launcher(int argc, char * argv[]) : argc(argc), argv(argv), help(false) {
+Launcher::Launcher(int argc, char * argv[]) : argc(argc), argv(argv), poolSize(2048), frameCacheSize(256), pinThreads(false), help(false) {
     Log::setOutputStream(cout);
     saveOptions.previewSize = 2;
 }
@@ -115,6 +122,13 @@ int Launcher::automaticMerge() {
     } else {
         optionsSet.push_back(generalOptions);
     }
+    // Sets of the same camera need the same buffers, so they are kept for the next set.
+    // The pool must outlive io, which frees its images into it.
+    BufferPool pool(size_t(poolSize) << 20);
+    if (optionsSet.size() > 1 && poolSize > 0) {
+        BufferAllocator::set(&pool);
+    }
+    CompressedFrame::setCacheSize(size_t(frameCacheSize) << 20);
     ImageIO io;
     int result = 0;
     for (LoadOptions & options : optionsSet) {
@@ -149,6 +163,10 @@ int Launcher::automaticMerge() {
         Log::progress(tr("Writing result to %1").arg(setOptions.fileName));
         io.save(setOptions, progress);
     }
+    if (&BufferAllocator::get() == &pool) {
+        Log::debug("Buffer pool: ", pool.getHits(), " reused, ", pool.getMisses(), " allocated");
+        BufferAllocator::set(nullptr);
+    }
     return result;
 }
 
@@ -171,6 +189,8 @@ void Launcher::parseCommandLine() {
             Log::setMinimumPriority(0);
         } else if (string("--no-align") == argv[i]) {
             generalOptions.align = false;
+        } else if (string("--align-green") == argv[i]) {
+            generalOptions.alignGreen = true;
         } else if (string("--no-crop") == argv[i]) {
             generalOptions.crop = false;
         } else if (string("--batch") == argv[i] || string("-B") == argv[i]) {
@@ -179,6 +199,10 @@ void Launcher::parseCommandLine() {
             generalOptions.withSingles = true;
         } else if (string("--help") == argv[i]) {
             help = true;
+        } else if (string("--no-margins") == argv[i]) {
+            saveOptions.activeAreaOnly = true;
+        } else if (string("--integer") == argv[i]) {
+            saveOptions.integerSamples = true;
         } else if (string("-b") == argv[i]) {
             if (++i < argc) {
                 try {
@@ -206,6 +230,42 @@ void Launcher::parseCommandLine() {
                     cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
                 }
             }
+        } else if (string("-j") == argv[i]) {
+            if (++i < argc) {
+                try {
+                    Threads::setCount(stoi(argv[i]));
+                } catch (std::invalid_argument & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
+        } else if (string("--pin") == argv[i]) {
+            pinThreads = true;
+        } else if (string("--pool-size") == argv[i]) {
+            if (++i < argc) {
+                try {
+                    poolSize = std::max(stoi(argv[i]), 0);
+                } catch (std::invalid_argument & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
+        } else if (string("--compress-frames") == argv[i]) {
+            generalOptions.compressFrames = true;
+        } else if (string("--frame-cache") == argv[i]) {
+            if (++i < argc) {
+                try {
+                    frameCacheSize = std::max(stoi(argv[i]), 0);
+                } catch (std::invalid_argument & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
+        } else if (string("--feather-samples") == argv[i]) {
+            if (++i < argc) {
+                try {
+                    saveOptions.featherSamples = std::max(stoi(argv[i]), 0);
+                } catch (std::invalid_argument & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
         } else if (string("-r") == argv[i]) {
             if (++i < argc) {
                 try {
@@ -214,6 +274,64 @@ void Launcher::parseCommandLine() {
                     cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
                 }
             }
+        } else if (string("-z") == argv[i]) {
+            if (++i < argc) {
+                try {
+                    int value = stoi(argv[i]);
+                    if (value < 0 || value > 9) throw std::out_of_range(argv[i]);
+                    saveOptions.compressionLevel = value;
+                } catch (std::logic_error & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
+        } else if (string("-t") == argv[i]) {
+            if (++i < argc) {
+                string tileSize(argv[i]);
+                size_t separator = tileSize.find('x');
+                if (tileSize == "auto") {
+                    saveOptions.tileWidth = saveOptions.tileLength = 0;
+                } else if (tileSize == "small") {
+                    saveOptions.tileWidth = saveOptions.tileLength = SaveOptions::smallTileSize;
+                } else if (tileSize == "large") {
+                    saveOptions.tileWidth = saveOptions.tileLength = SaveOptions::largeTileSize;
+                } else {
+                    try {
+                        int w = stoi(tileSize.substr(0, separator));
+                        int l = separator == string::npos ? w : stoi(tileSize.substr(separator + 1));
+                        if (w > 0 && l > 0) {
+                            saveOptions.tileWidth = w;
+                            saveOptions.tileLength = l;
+                        }
+                    } catch (std::invalid_argument & e) {
+                        cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                    }
+                }
+            }
+        } else if (string("--proxy") == argv[i]) {
+            if (++i < argc) {
+                saveOptions.saveProxy = true;
+                if (string("half") == argv[i]) {
+                    saveOptions.proxyLongEdge = 0;
+                } else {
+                    try {
+                        saveOptions.proxyLongEdge = std::max(stoi(argv[i]), 0);
+                    } catch (std::invalid_argument & e) {
+                        cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                    }
+                }
+            }
+        } else if (string("--huge-pages") == argv[i]) {
+            if (++i < argc) {
+                if (!BufferAllocator::setHugePages(argv[i])) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
+        } else if (string("--cpu-features") == argv[i]) {
+            if (++i < argc) {
+                if (!CpuFeatures::setMaximum(argv[i])) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+            }
         } else if (string("-p") == argv[i]) {
             if (++i < argc) {
                 string previewWidth(argv[i]);
@@ -227,6 +345,30 @@ void Launcher::parseCommandLine() {
                     cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
                 }
             }
+        } else if (string("-O") == argv[i]) {
+            if (++i < argc) {
+                // BPS,RADIUS,PREVIEW,FILE, empty fields take the value of the main output
+                string spec(argv[i]);
+                size_t c1 = spec.find(','), c2 = spec.find(',', c1 + 1), c3 = spec.find(',', c2 + 1);
+                if (c1 == string::npos || c2 == string::npos || c3 == string::npos || c3 + 1 == spec.length()) {
+                    cerr << tr("Invalid %1 parameter, ignoring it.").arg(argv[i - 1]) << endl;
+                    continue;
+                }
+                SaveOptions::Variant variant;
+                string bps = spec.substr(0, c1), radius = spec.substr(c1 + 1, c2 - c1 - 1), preview = spec.substr(c2 + 1, c3 - c2 - 1);
+                try {
+                    if (!bps.empty()) variant.bps = stoi(bps);
+                    if (!radius.empty()) variant.featherRadius = stoi(radius);
+                } catch (std::invalid_argument & e) {
+                    cerr << tr("Invalid %1 parameter, using default.").arg(argv[i - 1]) << endl;
+                }
+                if (variant.bps != 16 && variant.bps != 24 && variant.bps != 32) variant.bps = 0;
+                if (preview == "full") variant.previewSize = 2;
+                else if (preview == "half") variant.previewSize = 1;
+                else if (preview == "none") variant.previewSize = 0;
+                variant.fileName = QString::fromLocal8Bit(spec.substr(c3 + 1).c_str());
+                saveOptions.variants.push_back(variant);
+            }
         } else if (argv[i][0] != '-') {
             generalOptions.fileNames.push_back(QString::fromLocal8Bit(argv[i]));
         }
@@ -260,15 +402,47 @@ void Launcher::showHelp() {
     cout << "    " << "              " << tr("by comparing the creation time. Implies -a if no output file name is given.") << endl;
     cout << "    " << "-g gap        " << tr("Batch gap, maximum difference in seconds between two images of the same set.") << endl;
     cout << "    " << "--single      " << tr("Include single images in batch mode (the default is to skip them.)") << endl;
+    cout << "    " << "--pool-size MB" << endl;
+    cout << "    " << "              " << tr("Memory kept in batch mode to reuse the image buffers in the next set.") << endl;
+    cout << "    " << "              " << tr("Default is 2048, 0 returns them to the system after each set.") << endl;
+    cout << "    " << "--compress-frames" << endl;
+    cout << "    " << "              " << tr("Keep the source images compressed in memory, decoding them by strips.") << endl;
+    cout << "    " << "--frame-cache MB" << endl;
+    cout << "    " << "              " << tr("Memory for the decoded strips of compressed images. More memory, less decoding.") << endl;
+    cout << "    " << "              " << tr("Default is 256, 0 decodes the strips every time they are read.") << endl;
     cout << "    " << "-b BPS        " << tr("Bits per sample, can be 16, 24 or 32.") << endl;
+    cout << "    " << "--no-margins  " << tr("Write only the active area of the sensor, without the masked margins.") << endl;
+    cout << "    " << "--integer     " << tr("Store 16-bit integer samples on a companding curve, instead of floating point.") << endl;
+    cout << "    " << "              " << tr("Smaller and faster to decode, with a relative error below 1/2048. Ignores -b.") << endl;
     cout << "    " << "--no-align    " << tr("Do not auto-align source images.") << endl;
+    cout << "    " << "--align-green " << tr("Align on the green samples only, for 2x2 Bayer patterns.") << endl;
     cout << "    " << "--no-crop     " << tr("Do not crop the output image to the optimum size.") << endl;
     cout << "    " << "-m MASK_FILE  " << tr("Saves the mask to MASK_FILE as a PNG image.") << endl;
     cout << "    " << "              " << tr("Besides the parameters accepted by -o, it also accepts:") << endl;
     cout << "    " << "              - %of: " << tr("Replaced by the base file name of the output file.") << endl;
     cout << "    " << "              - %od: " << tr("Replaced by the directory name of the output file.") << endl;
     cout << "    " << "-r radius     " << tr("Mask blur radius, to soften transitions between images. Default is 3 pixels.") << endl;
+    cout << "    " << "--feather-samples N" << endl;
+    cout << "    " << "              " << tr("Blurs the mask at a reduced resolution, with at least N samples per radius.") << endl;
+    cout << "    " << "              " << tr("Lower is faster but less accurate, 0 blurs at full resolution. Default is 8.") << endl;
     cout << "    " << "-p size       " << tr("Preview size. Can be full, half or none.") << endl;
+    cout << "    " << "-z level      " << tr("Compression level of the raw data, from 0 (none) to 9 (max). Default is 6.") << endl;
+    cout << "    " << "-t size       " << tr("Size of the raw data tiles. Can be auto (about 512KB per tile, the default),") << endl;
+    cout << "    " << "              " << tr("small (256x256), large (1024x1024), WIDTHxLENGTH or SIDE, in pixels.") << endl;
+    cout << "    " << "              " << tr("Sizes are rounded up to a multiple of 16.") << endl;
+    cout << "    " << "-O spec       " << tr("Also writes a variant of the output, from the same images. The spec is") << endl;
+    cout << "    " << "              " << "BPS,RADIUS,PREVIEW,FILE, " << tr("empty fields take the value of the main output.") << endl;
+    cout << "    " << "              " << tr("FILE accepts the same parameters as -m. Can be given several times.") << endl;
+    cout << "    " << "--proxy size  " << tr("Also writes a reduced resolution DNG to %od/%of_proxy.dng. The size can be half,") << endl;
+    cout << "    " << "              " << tr("to bin the raw data 2x2 per color, or the long edge of the proxy in pixels.") << endl;
+    cout << "    " << "--cpu-features set" << endl;
+    cout << "    " << "              " << tr("Limits the vectorized code to an instruction set: generic, sse2, avx2 or avx512.") << endl;
+    cout << "    " << "              " << tr("By default, the best one supported by the CPU is used.") << endl;
+    cout << "    " << "-j threads    " << tr("Number of threads of the parallel loops. By default, one per CPU.") << endl;
+    cout << "    " << "--pin         " << tr("Binds each thread of the parallel loops to a CPU, when the GUI is not used.") << endl;
+    cout << "    " << "--huge-pages policy" << endl;
+    cout << "    " << "              " << tr("Huge pages for the large image buffers: none, transparent (the default) or explicit.") << endl;
+    cout << "    " << "              " << tr("Explicit uses the pages reserved in the system, if any.") << endl;
     cout << "    " << "-v            " << tr("Verbose mode.") << endl;
     cout << "    " << "-vv           " << tr("Debug mode.") << endl;
     cout << "    " << "-w whitelevel " << tr("Use custom white level.") << endl;
@@ -324,7 +498,19 @@ int Launcher::run() {
     app.installTranslator(&appTranslator);
 
     parseCommandLine();
+    // The GUI runs the parallel loops from the threads of Qt, which would inherit the CPU of the main thread
+    pinThreads = pinThreads && !useGUI;
+    if (pinThreads && !Threads::pin()) {
+        Log::progress("Cannot pin the threads to the CPUs");
+    }
+    // Place the large buffers in the node of the threads that use them
+    int numaNodes = Threads::numaNodes();
+    BufferAllocator::setFirstTouch(numaNodes > 1);
     Log::debug("Using LibRaw ", libraw_version());
+    Log::debug("Using ", Threads::count(), " threads", pinThreads ? " pinned to CPUs" : "", ", ", numaNodes, " NUMA nodes");
+    Log::debug("Using ", CpuFeatures::name(CpuFeatures::current()), " kernels, detected ",
+               CpuFeatures::name(CpuFeatures::detected()));
+    Log::debug("Using ", BufferAllocator::name(BufferAllocator::getHugePages()), " huge pages");
 
     if (help) {
         showHelp();
@@ -48,6 +48,9 @@ private:
     char ** argv;
     LoadOptions generalOptions;
     SaveOptions saveOptions;
+    int poolSize; ///< Maximum memory kept for reuse between sets in batch mode, in MB
+    int frameCacheSize; ///< Memory for the decoded strips of compressed frames, in MB
+    bool pinThreads;
     bool help;
 };
 
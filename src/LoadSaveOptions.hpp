@@ -31,14 +31,16 @@ namespace hdrmerge {
 struct LoadOptions {
     std::vector<QString> fileNames;
     bool align;
+    bool alignGreen;
     bool crop;
     bool useCustomWl;
     uint16_t customWl;
     bool batch;
     double batchGap;
     bool withSingles;
-    LoadOptions() : align(true), crop(true), useCustomWl(false), customWl(16383), batch(false), batchGap(2.0),
-        withSingles(false) {}
+    bool compressFrames; ///< Keep the frames compressed in memory, only in automatic mode
+    LoadOptions() : align(true), alignGreen(false), crop(true), useCustomWl(false), customWl(16383), batch(false), batchGap(2.0),
+        withSingles(false), compressFrames(false) {}
 };
 
 
@@ -49,7 +51,29 @@ struct SaveOptions {
     bool saveMask;
     QString maskFileName;
     int featherRadius;
-    SaveOptions() : bps(16), previewSize(0), saveMask(false), featherRadius(3) {}
+    int featherSamples; ///< Minimum blend map samples per feather radius, 0 to blur it at full resolution
+    int compressionLevel; ///< Deflate level of the raw data, from 0 (none) to 9 (max)
+    int tileWidth, tileLength; ///< Size of the raw tiles, 0 for tiles of about 512KB
+    bool integerSamples; ///< 16-bit integers on a companding curve instead of floats, ignores bps
+    bool activeAreaOnly; ///< Do not write the masked margins of the sensor
+    bool saveProxy;
+    int proxyLongEdge; ///< Long edge of the proxy DNG in pixels, 0 to bin 2x2 CFA blocks
+    QString proxyFileName;
+    /// An additional output, written from the same loaded images. Zero bps, a negative
+    /// radius or preview size take the value of the main output.
+    struct Variant {
+        int bps;
+        int featherRadius;
+        int previewSize;
+        QString fileName; ///< Accepts the parameters of ImageIO::replaceArguments
+        Variant() : bps(0), featherRadius(-1), previewSize(-1) {}
+    };
+    std::vector<Variant> variants;
+    static const int smallTileSize = 256;  ///< Preset for interactive zooming
+    static const int largeTileSize = 1024; ///< Preset for batch processing
+    SaveOptions() : bps(16), previewSize(0), saveMask(false), featherRadius(3), featherSamples(8), compressionLevel(6),
+        tileWidth(0), tileLength(0), integerSamples(false), activeAreaOnly(false), saveProxy(false), proxyLongEdge(0),
+        proxyFileName("%od/%of_proxy.dng") {}
 };
 
 } // namespace hdrmerge
@@ -0,0 +1,183 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "PreviewRenderer.hpp"
+#include "HalfFloat.hpp"
+#include "RawParameters.hpp"
+#include "Log.hpp"
+
+namespace hdrmerge {
+
+PreviewRenderer::PreviewRenderer(const RawParameters & p, float expShift) : params(p), exposure(expShift) {
+    float mul[4];
+    std::copy_n(params.camMul[0] > 0.0f ? params.camMul : params.preMul, 4, mul);
+    if (mul[0] <= 0.0f) {
+        std::fill_n(mul, 4, 1.0f);
+    }
+    if (mul[3] <= 0.0f) {
+        mul[3] = params.colors < 4 ? mul[1] : 1.0f;
+    }
+    float minMul = *std::min_element(mul, mul + 4);
+    float range = params.max > params.black ? params.max - params.black : 1.0f;
+    for (int c = 0; c < 4; ++c) {
+        factor[c] = mul[c] / (minMul * range);
+    }
+    params.camToRgb(rgbCam);
+    // BT.709 gamma, the default output curve of LibRaw
+    for (int i = 0; i < 0x10000; ++i) {
+        double v = i / 65535.0;
+        v = v < 0.018 ? 4.5 * v : 1.099 * std::pow(v, 0.45) - 0.099;
+        curve[i] = std::round(v * 255.0);
+    }
+}
+
+
+int PreviewRenderer::channel(int color) const {
+    // Both greens are the same channel in three color cameras
+    return color == 3 && params.colors == 3 ? 1 : color;
+}
+
+
+void PreviewRenderer::computeTaps(int scale, std::vector<std::vector<Tap>> & taps) const {
+    int periodX = params.FC.getColumns(), periodY = params.FC.getRows();
+    taps.resize(periodX * periodY);
+    for (int py = 0; py < periodY; ++py) {
+        for (int px = 0; px < periodX; ++px) {
+            std::vector<Tap> & phaseTaps = taps[py * periodX + px];
+            for (int ch = 0; ch < params.colors; ++ch) {
+                // Take the samples of each channel from the block, or from the
+                // smallest neighbourhood around it that contains that channel
+                for (int r = 0; r <= 2; ++r) {
+                    size_t first = phaseTaps.size();
+                    for (int dy = -r; dy < scale + r; ++dy) {
+                        for (int dx = -r; dx < scale + r; ++dx) {
+                            // Shift by one period, so that coordinates are never negative
+                            int color = params.FC(px + dx + periodX, py + dy + periodY);
+                            if (channel(color) == ch) {
+                                phaseTaps.push_back(Tap{ dx, dy, ch, (float)params.cblack[color], factor[color], 1.0f });
+                            }
+                        }
+                    }
+                    size_t count = phaseTaps.size() - first;
+                    if (count > 0) {
+                        for (size_t i = first; i < phaseTaps.size(); ++i) {
+                            phaseTaps[i].weight /= count;
+                            phaseTaps[i].share /= count;
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+uint8_t PreviewRenderer::toneMap(float v) const {
+    v *= exposure;
+    // Compress the highlights above the knee instead of clipping them
+    const float knee = 0.8f;
+    if (v > knee) {
+        v = knee + (1.0f - knee) * (1.0f - std::exp((knee - v) / (1.0f - knee)));
+    } else if (!(v > 0.0f)) {
+        v = 0.0f;
+    }
+    return curve[(int)(v * 65535.0f + 0.5f)];
+}
+
+
+template <typename T> QImage PreviewRenderer::renderThumbnail(const Array2D<T> & rawData, int minWidth) const {
+    // Keep the step even, so that the blocks of a Bayer pattern all start at the same color
+    int step = std::max((int)params.width / minWidth, 2) & ~1;
+    return renderBlocks(rawData, 2, step);
+}
+
+
+template <typename T> QImage PreviewRenderer::renderBlocks(const Array2D<T> & rawData, int scale, int step) const {
+    Timer t("Render preview");
+    int width = (params.width - scale) / step + 1, height = (params.height - scale) / step + 1;
+    if (params.width < (size_t)scale || params.height < (size_t)scale) return QImage();
+    QImage image(width, height, QImage::Format_RGB32);
+    if (image.isNull()) return image;
+
+    std::vector<std::vector<Tap>> taps;
+    computeTaps(scale, taps);
+    int periodX = params.FC.getColumns(), periodY = params.FC.getRows();
+    int activeWidth = params.width, activeHeight = params.height;
+    size_t stride = params.rawWidth;
+    const T * active = &rawData[params.topMargin * stride + params.leftMargin];
+    uchar * bits = image.bits();
+    int bytesPerLine = image.bytesPerLine();
+
+    #pragma omp parallel for schedule(dynamic,16)
+    for (int y = 0; y < height; ++y) {
+        QRgb * dst = (QRgb *)(bits + y * bytesPerLine);
+        int ay = y * step;
+        bool borderRow = ay < 2 || ay + scale + 2 > activeHeight;
+        // Walk the phases of the row without decoding the pattern per block
+        const std::vector<Tap> * rowTaps = &taps[(ay % periodY) * periodX];
+        int stepX = step % periodX;
+        for (int x = 0, px = 0; x < width; ++x) {
+            int ax = x * step;
+            const std::vector<Tap> & phaseTaps = rowTaps[px];
+            px += stepX;
+            if (px >= periodX) px -= periodX;
+            float cam[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            if (borderRow || ax < 2 || ax + scale + 2 > activeWidth) {
+                // Skip the samples outside the active area, and renormalize
+                float shares[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (const Tap & tap : phaseTaps) {
+                    int sx = ax + tap.dx, sy = ay + tap.dy;
+                    if (sx >= 0 && sx < activeWidth && sy >= 0 && sy < activeHeight) {
+                        cam[tap.channel] += tap.weight * (active[sy * stride + sx] - tap.black);
+                        shares[tap.channel] += tap.share;
+                    }
+                }
+                for (int c = 0; c < 4; ++c) {
+                    if (shares[c] > 0.0f) {
+                        cam[c] /= shares[c];
+                    }
+                }
+            } else {
+                const T * block = active + ay * stride + ax;
+                for (const Tap & tap : phaseTaps) {
+                    cam[tap.channel] += tap.weight * (block[tap.dy * (int)stride + tap.dx] - tap.black);
+                }
+            }
+            float rgb[3];
+            for (int c = 0; c < 3; ++c) {
+                rgb[c] = rgbCam[c][0] * cam[0] + rgbCam[c][1] * cam[1] + rgbCam[c][2] * cam[2] + rgbCam[c][3] * cam[3];
+            }
+            dst[x] = qRgb(toneMap(rgb[0]), toneMap(rgb[1]), toneMap(rgb[2]));
+        }
+    }
+    return image;
+}
+
+template QImage PreviewRenderer::renderThumbnail(const Array2D<float> & rawData, int minWidth) const;
+template QImage PreviewRenderer::renderThumbnail(const Array2D<HalfFloat> & rawData, int minWidth) const;
+template QImage PreviewRenderer::renderBlocks(const Array2D<float> & rawData, int scale, int step) const;
+template QImage PreviewRenderer::renderBlocks(const Array2D<HalfFloat> & rawData, int scale, int step) const;
+
+} // namespace hdrmerge
@@ -0,0 +1,70 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PREVIEWRENDERER_HPP_
+#define _PREVIEWRENDERER_HPP_
+
+#include <vector>
+#include <QImage>
+#include "Array2D.hpp"
+
+namespace hdrmerge {
+
+class RawParameters;
+
+/// Renders an sRGB image from the composed raw data, without going back to the input files.
+class PreviewRenderer {
+public:
+    PreviewRenderer(const RawParameters & params, float expShift);
+
+    /// Demosaics the active area with bilinear interpolation (scale 1) or
+    /// by averaging the samples of each block of scale x scale pixels.
+    template <typename T> QImage render(const Array2D<T> & rawData, int scale = 1) const {
+        return renderBlocks(rawData, scale, scale);
+    }
+    /// Quickly renders an image at least minWidth pixels wide, from a 2x2 block every few pixels.
+    template <typename T> QImage renderThumbnail(const Array2D<T> & rawData, int minWidth) const;
+
+private:
+    /// A sample that contributes to a channel of the output pixel
+    struct Tap {
+        int dx, dy, channel;
+        float black;
+        float weight;   ///< Includes the scale factor of the sample color
+        float share;    ///< Plain fraction of the channel, to renormalize at the borders
+    };
+
+    const RawParameters & params;
+    float exposure;
+    float factor[4];    ///< Black to white range and white balance multiplier for each CFA color
+    float rgbCam[3][4];
+    uint8_t curve[0x10000];
+
+    template <typename T> QImage renderBlocks(const Array2D<T> & rawData, int scale, int step) const;
+    void computeTaps(int scale, std::vector<std::vector<Tap>> & taps) const;
+    int channel(int color) const;
+    uint8_t toneMap(float v) const;
+};
+
+} // namespace hdrmerge
+
+#endif // _PREVIEWRENDERER_HPP_
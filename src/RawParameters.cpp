@@ -27,6 +27,8 @@
 #include <QFileInfo>
 #include <libraw.h>
 #include <exiv2/exiv2.hpp>
+#include "CFALookup.hpp"
+#include "Image.hpp"
 #include "Log.hpp"
 #include "RawParameters.hpp"
 using namespace hdrmerge;
@@ -167,6 +169,39 @@ void RawParameters::camXyzFromRgbCam() {
 }
 
 
+void RawParameters::camToRgb(float (*rgbCamOut)[4]) const {
+    // Same as LibRaw's cam_xyz_coeff, without modifying the multipliers
+    const double xyzRgb[3][3] = {
+        { 0.412453, 0.357580, 0.180423 },
+        { 0.212671, 0.715160, 0.072169 },
+        { 0.019334, 0.119193, 0.950227 }
+    };
+    double camRgb[4][3], inverse[4][3];
+    for (int i = 0; i < colors; ++i) {
+        double sum = 0.0;
+        for (int j = 0; j < 3; ++j) {
+            camRgb[i][j] = 0.0;
+            for (int k = 0; k < 3; ++k) {
+                camRgb[i][j] += camXyz[i][k] * xyzRgb[k][j];
+            }
+            sum += camRgb[i][j];
+        }
+        // Normalize so that a white balanced white is white in sRGB
+        if (sum != 0.0) {
+            for (int j = 0; j < 3; ++j) {
+                camRgb[i][j] /= sum;
+            }
+        }
+    }
+    pseudoinverse(camRgb, inverse, colors);
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            rgbCamOut[i][j] = j < colors ? inverse[j][i] : 0.0;
+        }
+    }
+}
+
+
 void RawParameters::calculateCamXyz() {
     // LibRaw does not create this matrix for DNG files!!!
     loadCamXyzFromDng();
@@ -272,7 +307,7 @@ void RawParameters::adjustBlack() {
 }
 
 
-void RawParameters::adjustWhite(const Array2D<uint16_t> & image) {
+void RawParameters::adjustWhite(const Image & image) {
     if (camMul[0] == 0) {
         autoWB(image);
     } else if (camMul[1] == 0) {
@@ -294,37 +329,63 @@ void RawParameters::adjustWhite(const Array2D<uint16_t> & image) {
 }
 
 
-void RawParameters::autoWB(const Array2D<uint16_t> & image) {
-    Timer t("AutoWB");
-    double dsum[4] = { 0.0, 0.0, 0.0, 0.0 };
-    size_t dcount[4] = { 0, 0, 0, 0 };
-    for (size_t row = 0; row < image.getHeight(); row += 8) {
-        for (size_t col = 0; col < image.getWidth() ; col += 8) {
-            double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
-            size_t count[4] = { 0, 0, 0, 0 };
-            size_t ymax = std::min(row + 8, image.getHeight());
-            size_t xmax = std::min(col + 8, image.getWidth());
-            bool skipBlock = false;
-            for (size_t y = row; y < ymax && !skipBlock; y++) {
-                for (size_t x = col; x < xmax; x++) {
-                    int c = FC(x, y);
-                    uint16_t val = image(x, y);
-                    if (val > max - 25) {
-                        skipBlock = true;
-                        break;
+namespace {
+
+// Sums the values of each color, skipping the 8x8 blocks with a value above limit
+struct SumColors {
+    const Image & image;
+    int limit;
+    double * dsum;
+    size_t * dcount;
+
+    template <typename CFA> void operator()(const CFA & cfa) const {
+        // A compressed image is decoded into a view by bands, of whole blocks
+        const size_t bandRows = CompressedFrame::stripRows;
+        static_assert(bandRows % 8 == 0, "Bands must hold whole blocks");
+        Image view = image.isCompressed() ? image.view() : Image();
+        const Image & src = image.isCompressed() ? view : image;
+        for (size_t row = 0; row < image.getHeight(); row += 8) {
+            if (image.isCompressed() && row % bandRows == 0) {
+                view.loadRows(row, std::min(row + bandRows, image.getHeight()));
+            }
+            for (size_t col = 0; col < image.getWidth() ; col += 8) {
+                double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+                size_t count[4] = { 0, 0, 0, 0 };
+                size_t ymax = std::min(row + 8, image.getHeight());
+                size_t xmax = std::min(col + 8, image.getWidth());
+                bool skipBlock = false;
+                for (size_t y = row; y < ymax && !skipBlock; y++) {
+                    const typename CFA::Row & colors = cfa.row(y);
+                    for (size_t x = col; x < xmax; x++) {
+                        int c = colors.color[x % CFA::columns];
+                        uint16_t val = src(x, y);
+                        if (val > limit) {
+                            skipBlock = true;
+                            break;
+                        }
+                        sum[c] += val;
+                        count[c]++;
                     }
-                    sum[c] += val;
-                    count[c]++;
                 }
-            }
-            if (!skipBlock) {
-                for (int c = 0; c < 4; ++c) {
-                    dsum[c] += sum[c];
-                    dcount[c] += count[c];
+                if (!skipBlock) {
+                    for (int c = 0; c < 4; ++c) {
+                        dsum[c] += sum[c];
+                        dcount[c] += count[c];
+                    }
                 }
             }
         }
     }
+};
+
+} // namespace
+
+
+void RawParameters::autoWB(const Image & image) {
+    Timer t("AutoWB");
+    double dsum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    size_t dcount[4] = { 0, 0, 0, 0 };
+    dispatchCFA(*this, SumColors{image, max - 25, dsum, dcount});
     for (int c = 0; c < 4; ++c) {
         if (dsum[c] > 0.0) {
             camMul[c] = dcount[c] / dsum[c];
@@ -31,6 +31,8 @@ class LibRaw;
 
 namespace hdrmerge {
 
+class Image;
+
 class RawParameters {
 public:
     RawParameters();
@@ -55,8 +57,11 @@ public:
     float whiteMultAt(int x, int y) const {
         return camMul[FC(x, y)];
     }
-    void adjustWhite(const Array2D<uint16_t> & image);
-    void autoWB(const Array2D<uint16_t> & image);
+    /// Reads a compressed image by bands of rows, without decoding it at once
+    void adjustWhite(const Image & image);
+    void autoWB(const Image & image);
+    /// Matrix from white balanced camera colors to linear sRGB, derived from camXyz
+    void camToRgb(float (*rgbCamOut)[4]) const;
     bool canAlign() const { return FC.canAlign(); }
 
     QString fileName;
@@ -0,0 +1,82 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "CpuFeatures.hpp"
+#include "SimdKernels.hpp"
+
+namespace hdrmerge {
+
+namespace generic {
+
+static size_t splitFloatPlanes(const float *, uint8_t *, size_t, size_t, int) {
+    return 0;
+}
+
+
+static void encodeDelta(uint8_t * buffer, size_t length) {
+    uint8_t before2 = 0, before1 = 0; // Original values at i - 2 and i - 1
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t v = buffer[i];
+        buffer[i] = v - before2;
+        before2 = before1;
+        before1 = v;
+    }
+}
+
+
+static size_t fattenColumns(const uint8_t * const *, int, uint8_t * const *, size_t) {
+    return 0;
+}
+
+
+static size_t fattenRow(const uint8_t * const *, const int *, int, uint8_t *, size_t x, size_t) {
+    return x;
+}
+
+
+const SimdKernels kernels = {
+    splitFloatPlanes,
+    encodeDelta,
+    fattenColumns,
+    fattenRow,
+};
+
+} // namespace generic
+
+
+const SimdKernels & SimdKernels::get() {
+    switch (CpuFeatures::current()) {
+#ifdef HAVE_AVX512_KERNELS
+        case CpuFeatures::AVX512: return avx512::kernels;
+#endif
+#ifdef HAVE_AVX2_KERNELS
+        case CpuFeatures::AVX2: return avx2::kernels;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+        case CpuFeatures::SSE2: return sse2::kernels;
+#endif
+        default: return generic::kernels;
+    }
+}
+
+} // namespace hdrmerge
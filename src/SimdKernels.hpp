@@ -0,0 +1,58 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SIMDKERNELS_HPP_
+#define _SIMDKERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hdrmerge {
+
+/// The inner loops that have a vector implementation. There is one table for each
+/// instruction set, compiled in its own source file with the corresponding flags, and
+/// get() returns the one for the current CpuFeatures level. The kernels process as many
+/// elements as their vector width allows and return where the caller must continue with
+/// scalar code. All of them produce exactly the same results.
+struct SimdKernels {
+    /// Encodes the first columns of a floating point tile row in byte planes, see encodeFloatRow.
+    size_t (*splitFloatPlanes)(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps);
+    /// Applies the delta of predictor 34894 with a factor of 2 to the whole buffer.
+    void (*encodeDelta)(uint8_t * buffer, size_t length);
+    /// Sets maxArray[i][x] to the maximum of rows[-i][x] ... rows[i][x], for i in [1, radius].
+    size_t (*fattenColumns)(const uint8_t * const * rows, int radius, uint8_t * const * maxArray, size_t width);
+    /// Sets result[x] to the maximum of maxArray[circ[i]][x + i], for i in [-radius, radius],
+    /// starting at column x >= radius.
+    size_t (*fattenRow)(const uint8_t * const * maxArray, const int * circ, int radius,
+                        uint8_t * result, size_t x, size_t width);
+
+    static const SimdKernels & get();
+};
+
+namespace generic { extern const SimdKernels kernels; }
+namespace sse2 { extern const SimdKernels kernels; }
+namespace avx2 { extern const SimdKernels kernels; }
+namespace avx512 { extern const SimdKernels kernels; }
+
+} // namespace hdrmerge
+
+#endif // _SIMDKERNELS_HPP_
@@ -0,0 +1,189 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Compiled with -mavx2
+#ifdef __AVX2__
+#include <x86intrin.h>
+#include "SimdKernels.hpp"
+
+namespace hdrmerge {
+
+namespace avx2 {
+
+static inline __m256i select(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+
+// Vector version of DNG_FloatToHalf
+static inline __m256i floatToHalf(__m256 f) {
+    __m256i i = _mm256_castps_si256(f);
+    __m256i sign = _mm256_and_si256(_mm256_srli_epi32(i, 16), _mm256_set1_epi32(0x8000));
+    __m256i biased = _mm256_and_si256(_mm256_srli_epi32(i, 23), _mm256_set1_epi32(0xff));
+    __m256i mantissa = _mm256_and_si256(i, _mm256_set1_epi32(0x7fffff));
+    __m256i inf = _mm256_set1_epi32(0x7c00);
+    // Normal numbers: the rounding may carry into the exponent, and overflow to infinity
+    __m256i normal = _mm256_add_epi32(_mm256_slli_epi32(_mm256_sub_epi32(biased, _mm256_set1_epi32(112)), 10),
+                                      _mm256_srli_epi32(mantissa, 13));
+    normal = _mm256_add_epi32(normal, _mm256_and_si256(_mm256_srli_epi32(mantissa, 12), _mm256_set1_epi32(1)));
+    normal = _mm256_min_epi32(normal, inf);
+    // Subnormal numbers: round(|f| * 2^24), with ties away from zero
+    __m256 absf = _mm256_and_ps(f, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+    __m256i twice = _mm256_cvttps_epi32(_mm256_mul_ps(absf, _mm256_set1_ps(33554432.0f)));
+    __m256i subnormal = _mm256_srli_epi32(_mm256_add_epi32(twice, _mm256_set1_epi32(1)), 1);
+    __m256i nanInf = _mm256_or_si256(inf, _mm256_srli_epi32(mantissa, 13));
+
+    __m256i result = select(_mm256_cmpgt_epi32(_mm256_set1_epi32(113), biased), subnormal, normal);
+    result = select(_mm256_cmpeq_epi32(biased, _mm256_set1_epi32(255)), nanInf, result);
+    return _mm256_or_si256(result, sign);
+}
+
+
+// Vector version of DNG_FloatToFP24
+static inline __m256i floatToFP24(__m256 f) {
+    __m256i i = _mm256_castps_si256(f);
+    __m256i sign = _mm256_and_si256(_mm256_srli_epi32(i, 24), _mm256_set1_epi32(0x80));
+    __m256i biased = _mm256_and_si256(_mm256_srli_epi32(i, 23), _mm256_set1_epi32(0xff));
+    __m256i mantissa = _mm256_and_si256(i, _mm256_set1_epi32(0x7fffff));
+    __m256i exponent = _mm256_sub_epi32(biased, _mm256_set1_epi32(64)); // Already biased by 64
+    __m256i isNaN = _mm256_cmpeq_epi32(biased, _mm256_set1_epi32(255));
+    __m256i isBig = _mm256_andnot_si256(isNaN, _mm256_cmpgt_epi32(biased, _mm256_set1_epi32(191)));
+    __m256i isSmall = _mm256_cmpgt_epi32(_mm256_set1_epi32(65), biased);
+
+    __m256i knockOut = _mm256_andnot_si256(_mm256_cmpeq_epi32(mantissa, _mm256_set1_epi32(0x7fffff)),
+                                           _mm256_cmpeq_epi32(_mm256_srli_epi32(mantissa, 7), _mm256_set1_epi32(0xffff)));
+    mantissa = select(_mm256_and_si256(isNaN, knockOut), _mm256_and_si256(mantissa, _mm256_set1_epi32(0x3fffff)), mantissa);
+    mantissa = select(isBig, _mm256_set1_epi32(0x7fffff), mantissa);
+    exponent = select(isBig, _mm256_set1_epi32(127), exponent);
+    // Denormalized: (mantissa | 0x800000) >> (-63 - exponent) == |f| * 2^85, zero below 2^-79
+    __m256 absf = _mm256_and_ps(f, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+    __m256i denormal = _mm256_cvttps_epi32(_mm256_mul_ps(absf, _mm256_set1_ps(38685626227668133590597632.0f)));
+    denormal = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(49), biased), denormal);
+    mantissa = select(isSmall, denormal, mantissa);
+    exponent = _mm256_andnot_si256(isSmall, exponent);
+
+    return _mm256_or_si256(_mm256_slli_epi32(_mm256_or_si256(sign, exponent), 16),
+                           _mm256_and_si256(_mm256_srli_epi32(mantissa, 7), _mm256_set1_epi32(0xffff)));
+}
+
+
+template <int bytesps> __m256i encodeSamples(__m256 f);
+template <> inline __m256i encodeSamples<2>(__m256 f) { return floatToHalf(f); }
+template <> inline __m256i encodeSamples<3>(__m256 f) { return floatToFP24(f); }
+template <> inline __m256i encodeSamples<4>(__m256 f) { return _mm256_castps_si256(f); }
+
+
+// Encodes 32 samples at a time and scatters their bytes to the planes
+template <int bytesps> static size_t splitPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth) {
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    // The packs work on each 128-bit lane, this restores the order of the groups of 4 bytes
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t col = 0;
+    for (; col + 32 <= width; col += 32) {
+        __m256i v[4];
+        for (int i = 0; i < 4; ++i) {
+            v[i] = encodeSamples<bytesps>(_mm256_loadu_ps(&src[col + 8*i]));
+        }
+        for (int plane = 0; plane < bytesps; ++plane) {
+            __m128i shift = _mm_cvtsi32_si128(8 * (bytesps - 1 - plane));
+            __m256i b[4];
+            for (int i = 0; i < 4; ++i) {
+                b[i] = _mm256_and_si256(_mm256_srl_epi32(v[i], shift), byteMask);
+            }
+            __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(b[0], b[1]), _mm256_packs_epi32(b[2], b[3]));
+            _mm256_storeu_si256((__m256i *)&dst[plane*tileWidth + col], _mm256_permutevar8x32_epi32(bytes, order));
+        }
+    }
+    return col;
+}
+
+
+static size_t splitFloatPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps) {
+    switch (bytesps) {
+        case 2: return splitPlanes<2>(src, dst, width, tileWidth);
+        case 3: return splitPlanes<3>(src, dst, width, tileWidth);
+        case 4: return splitPlanes<4>(src, dst, width, tileWidth);
+        default: return 0;
+    }
+}
+
+
+static void encodeDelta(uint8_t * buffer, size_t length) {
+    size_t i = 0;
+    __m256i prev = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *)&buffer[i]);
+        // Shift two bytes in, across the 128-bit lanes: the high lane of prev and the low lane of v
+        __m256i shifted = _mm256_alignr_epi8(v, _mm256_permute2x128_si256(prev, v, 0x21), 14);
+        _mm256_storeu_si256((__m256i *)&buffer[i], _mm256_sub_epi8(v, shifted));
+        prev = v;
+    }
+    uint16_t last = _mm256_extract_epi16(prev, 15);
+    uint8_t before2 = last & 0xff, before1 = last >> 8; // Original values at i - 2 and i - 1
+    for (; i < length; ++i) {
+        uint8_t v = buffer[i];
+        buffer[i] = v - before2;
+        before2 = before1;
+        before1 = v;
+    }
+}
+
+
+static size_t fattenColumns(const uint8_t * const * rows, int radius, uint8_t * const * maxArray, size_t width) {
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i lmax = _mm256_loadu_si256((__m256i*)&rows[0][x]);
+        if (radius < 2) // maxArray[0] is only used when radius < 2
+            _mm256_storeu_si256((__m256i*)&maxArray[0][x], lmax);
+        for (int i = 1; i <= radius; i++) {
+            lmax = _mm256_max_epu8(_mm256_loadu_si256((__m256i*)&rows[i][x]), lmax);
+            lmax = _mm256_max_epu8(_mm256_loadu_si256((__m256i*)&rows[-i][x]), lmax);
+            _mm256_storeu_si256((__m256i*)&maxArray[i][x], lmax);
+        }
+    }
+    return x;
+}
+
+
+static size_t fattenRow(const uint8_t * const * maxArray, const int * circ, int radius,
+                        uint8_t * result, size_t x, size_t width) {
+    for (; x + 32 + radius <= width; x += 32) {
+        __m256i lmax = _mm256_loadu_si256((__m256i*)&maxArray[circ[radius]][x + radius]);
+        for (int i = radius - 1; i >= -radius; i--)
+            lmax = _mm256_max_epu8(lmax, _mm256_loadu_si256((__m256i*)&maxArray[circ[i]][x + i]));
+        _mm256_storeu_si256((__m256i*)&result[x], lmax);
+    }
+    return x;
+}
+
+
+const SimdKernels kernels = {
+    splitFloatPlanes,
+    encodeDelta,
+    fattenColumns,
+    fattenRow,
+};
+
+} // namespace avx2
+
+} // namespace hdrmerge
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Compiled with -mavx512f -mavx512bw
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// GCC implements several AVX-512 intrinsics with a self-initialized __Y placeholder
+// (_mm512_undefined_*), which -Wall reports as uninitialized once inlined here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <x86intrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#include "SimdKernels.hpp"
+
+namespace hdrmerge {
+
+namespace avx512 {
+
+// Vector version of DNG_FloatToHalf
+static inline __m512i floatToHalf(__m512 f) {
+    __m512i i = _mm512_castps_si512(f);
+    __m512i sign = _mm512_and_si512(_mm512_srli_epi32(i, 16), _mm512_set1_epi32(0x8000));
+    __m512i biased = _mm512_and_si512(_mm512_srli_epi32(i, 23), _mm512_set1_epi32(0xff));
+    __m512i mantissa = _mm512_and_si512(i, _mm512_set1_epi32(0x7fffff));
+    __m512i inf = _mm512_set1_epi32(0x7c00);
+    // Normal numbers: the rounding may carry into the exponent, and overflow to infinity
+    __m512i normal = _mm512_add_epi32(_mm512_slli_epi32(_mm512_sub_epi32(biased, _mm512_set1_epi32(112)), 10),
+                                      _mm512_srli_epi32(mantissa, 13));
+    normal = _mm512_add_epi32(normal, _mm512_and_si512(_mm512_srli_epi32(mantissa, 12), _mm512_set1_epi32(1)));
+    normal = _mm512_min_epi32(normal, inf);
+    // Subnormal numbers: round(|f| * 2^24), with ties away from zero
+    __m512 absf = _mm512_castsi512_ps(_mm512_and_si512(i, _mm512_set1_epi32(0x7fffffff)));
+    __m512i twice = _mm512_cvttps_epi32(_mm512_mul_ps(absf, _mm512_set1_ps(33554432.0f)));
+    __m512i subnormal = _mm512_srli_epi32(_mm512_add_epi32(twice, _mm512_set1_epi32(1)), 1);
+    __m512i nanInf = _mm512_or_si512(inf, _mm512_srli_epi32(mantissa, 13));
+
+    __m512i result = _mm512_mask_blend_epi32(_mm512_cmplt_epi32_mask(biased, _mm512_set1_epi32(113)), normal, subnormal);
+    result = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(biased, _mm512_set1_epi32(255)), result, nanInf);
+    return _mm512_or_si512(result, sign);
+}
+
+
+// Vector version of DNG_FloatToFP24
+static inline __m512i floatToFP24(__m512 f) {
+    __m512i i = _mm512_castps_si512(f);
+    __m512i sign = _mm512_and_si512(_mm512_srli_epi32(i, 24), _mm512_set1_epi32(0x80));
+    __m512i biased = _mm512_and_si512(_mm512_srli_epi32(i, 23), _mm512_set1_epi32(0xff));
+    __m512i mantissa = _mm512_and_si512(i, _mm512_set1_epi32(0x7fffff));
+    __m512i exponent = _mm512_sub_epi32(biased, _mm512_set1_epi32(64)); // Already biased by 64
+    __mmask16 isNaN = _mm512_cmpeq_epi32_mask(biased, _mm512_set1_epi32(255));
+    __mmask16 isBig = _mm512_cmpgt_epi32_mask(biased, _mm512_set1_epi32(191)) & ~isNaN;
+    __mmask16 isSmall = _mm512_cmplt_epi32_mask(biased, _mm512_set1_epi32(65));
+
+    __mmask16 knockOut = isNaN & ~_mm512_cmpeq_epi32_mask(mantissa, _mm512_set1_epi32(0x7fffff))
+        & _mm512_cmpeq_epi32_mask(_mm512_srli_epi32(mantissa, 7), _mm512_set1_epi32(0xffff));
+    mantissa = _mm512_mask_and_epi32(mantissa, knockOut, mantissa, _mm512_set1_epi32(0x3fffff));
+    mantissa = _mm512_mask_mov_epi32(mantissa, isBig, _mm512_set1_epi32(0x7fffff));
+    exponent = _mm512_mask_mov_epi32(exponent, isBig, _mm512_set1_epi32(127));
+    // Denormalized: (mantissa | 0x800000) >> (-63 - exponent) == |f| * 2^85, zero below 2^-79
+    __m512 absf = _mm512_castsi512_ps(_mm512_and_si512(i, _mm512_set1_epi32(0x7fffffff)));
+    __m512i denormal = _mm512_cvttps_epi32(_mm512_mul_ps(absf, _mm512_set1_ps(38685626227668133590597632.0f)));
+    denormal = _mm512_maskz_mov_epi32(_mm512_cmpge_epi32_mask(biased, _mm512_set1_epi32(49)), denormal);
+    mantissa = _mm512_mask_mov_epi32(mantissa, isSmall, denormal);
+    exponent = _mm512_maskz_mov_epi32(~isSmall, exponent);
+
+    return _mm512_or_si512(_mm512_slli_epi32(_mm512_or_si512(sign, exponent), 16),
+                           _mm512_and_si512(_mm512_srli_epi32(mantissa, 7), _mm512_set1_epi32(0xffff)));
+}
+
+
+template <int bytesps> __m512i encodeSamples(__m512 f);
+template <> inline __m512i encodeSamples<2>(__m512 f) { return floatToHalf(f); }
+template <> inline __m512i encodeSamples<3>(__m512 f) { return floatToFP24(f); }
+template <> inline __m512i encodeSamples<4>(__m512 f) { return _mm512_castps_si512(f); }
+
+
+// Encodes 16 samples at a time and narrows each plane with a truncating move
+template <int bytesps> static size_t splitPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth) {
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16) {
+        __m512i v = encodeSamples<bytesps>(_mm512_loadu_ps(&src[col]));
+        for (int plane = 0; plane < bytesps; ++plane) {
+            __m128i shift = _mm_cvtsi32_si128(8 * (bytesps - 1 - plane));
+            __m128i bytes = _mm512_cvtepi32_epi8(_mm512_srl_epi32(v, shift));
+            _mm_storeu_si128((__m128i *)&dst[plane*tileWidth + col], bytes);
+        }
+    }
+    return col;
+}
+
+
+static size_t splitFloatPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps) {
+    switch (bytesps) {
+        case 2: return splitPlanes<2>(src, dst, width, tileWidth);
+        case 3: return splitPlanes<3>(src, dst, width, tileWidth);
+        case 4: return splitPlanes<4>(src, dst, width, tileWidth);
+        default: return 0;
+    }
+}
+
+
+static void encodeDelta(uint8_t * buffer, size_t length) {
+    size_t i = 0;
+    __m512i prev = _mm512_setzero_si512();
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512(&buffer[i]);
+        // Shift two bytes in, across the 128-bit lanes: pair each lane of v with the previous one
+        __m512i shifted = _mm512_alignr_epi8(v, _mm512_alignr_epi32(v, prev, 12), 14);
+        _mm512_storeu_si512(&buffer[i], _mm512_sub_epi8(v, shifted));
+        prev = v;
+    }
+    uint16_t last = _mm_extract_epi16(_mm512_extracti32x4_epi32(prev, 3), 7);
+    uint8_t before2 = last & 0xff, before1 = last >> 8; // Original values at i - 2 and i - 1
+    for (; i < length; ++i) {
+        uint8_t v = buffer[i];
+        buffer[i] = v - before2;
+        before2 = before1;
+        before1 = v;
+    }
+}
+
+
+static size_t fattenColumns(const uint8_t * const * rows, int radius, uint8_t * const * maxArray, size_t width) {
+    size_t x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m512i lmax = _mm512_loadu_si512(&rows[0][x]);
+        if (radius < 2) // maxArray[0] is only used when radius < 2
+            _mm512_storeu_si512(&maxArray[0][x], lmax);
+        for (int i = 1; i <= radius; i++) {
+            lmax = _mm512_max_epu8(_mm512_loadu_si512(&rows[i][x]), lmax);
+            lmax = _mm512_max_epu8(_mm512_loadu_si512(&rows[-i][x]), lmax);
+            _mm512_storeu_si512(&maxArray[i][x], lmax);
+        }
+    }
+    return x;
+}
+
+
+static size_t fattenRow(const uint8_t * const * maxArray, const int * circ, int radius,
+                        uint8_t * result, size_t x, size_t width) {
+    for (; x + 64 + radius <= width; x += 64) {
+        __m512i lmax = _mm512_loadu_si512(&maxArray[circ[radius]][x + radius]);
+        for (int i = radius - 1; i >= -radius; i--)
+            lmax = _mm512_max_epu8(lmax, _mm512_loadu_si512(&maxArray[circ[i]][x + i]));
+        _mm512_storeu_si512(&result[x], lmax);
+    }
+    return x;
+}
+
+
+const SimdKernels kernels = {
+    splitFloatPlanes,
+    encodeDelta,
+    fattenColumns,
+    fattenRow,
+};
+
+} // namespace avx512
+
+} // namespace hdrmerge
+#endif
@@ -0,0 +1,186 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Compiled with -msse2
+#ifdef __SSE2__
+#include <x86intrin.h>
+#include "SimdKernels.hpp"
+
+namespace hdrmerge {
+
+namespace sse2 {
+
+static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+
+// Vector version of DNG_FloatToHalf
+static inline __m128i floatToHalf(__m128 f) {
+    __m128i i = _mm_castps_si128(f);
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(i, 16), _mm_set1_epi32(0x8000));
+    __m128i biased = _mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(0xff));
+    __m128i mantissa = _mm_and_si128(i, _mm_set1_epi32(0x7fffff));
+    __m128i inf = _mm_set1_epi32(0x7c00);
+    // Normal numbers: the rounding may carry into the exponent, and overflow to infinity
+    __m128i normal = _mm_add_epi32(_mm_slli_epi32(_mm_sub_epi32(biased, _mm_set1_epi32(112)), 10),
+                                   _mm_srli_epi32(mantissa, 13));
+    normal = _mm_add_epi32(normal, _mm_and_si128(_mm_srli_epi32(mantissa, 12), _mm_set1_epi32(1)));
+    normal = select(_mm_cmpgt_epi32(normal, inf), inf, normal);
+    // Subnormal numbers: round(|f| * 2^24), with ties away from zero
+    __m128 absf = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+    __m128i twice = _mm_cvttps_epi32(_mm_mul_ps(absf, _mm_set1_ps(33554432.0f)));
+    __m128i subnormal = _mm_srli_epi32(_mm_add_epi32(twice, _mm_set1_epi32(1)), 1);
+    __m128i nanInf = _mm_or_si128(inf, _mm_srli_epi32(mantissa, 13));
+
+    __m128i result = select(_mm_cmplt_epi32(biased, _mm_set1_epi32(113)), subnormal, normal);
+    result = select(_mm_cmpeq_epi32(biased, _mm_set1_epi32(255)), nanInf, result);
+    return _mm_or_si128(result, sign);
+}
+
+
+// Vector version of DNG_FloatToFP24
+static inline __m128i floatToFP24(__m128 f) {
+    __m128i i = _mm_castps_si128(f);
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(i, 24), _mm_set1_epi32(0x80));
+    __m128i biased = _mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(0xff));
+    __m128i mantissa = _mm_and_si128(i, _mm_set1_epi32(0x7fffff));
+    __m128i exponent = _mm_sub_epi32(biased, _mm_set1_epi32(64)); // Already biased by 64
+    __m128i isNaN = _mm_cmpeq_epi32(biased, _mm_set1_epi32(255));
+    __m128i isBig = _mm_andnot_si128(isNaN, _mm_cmpgt_epi32(biased, _mm_set1_epi32(191)));
+    __m128i isSmall = _mm_cmplt_epi32(biased, _mm_set1_epi32(65));
+
+    __m128i knockOut = _mm_andnot_si128(_mm_cmpeq_epi32(mantissa, _mm_set1_epi32(0x7fffff)),
+                                        _mm_cmpeq_epi32(_mm_srli_epi32(mantissa, 7), _mm_set1_epi32(0xffff)));
+    mantissa = select(_mm_and_si128(isNaN, knockOut), _mm_and_si128(mantissa, _mm_set1_epi32(0x3fffff)), mantissa);
+    mantissa = select(isBig, _mm_set1_epi32(0x7fffff), mantissa);
+    exponent = select(isBig, _mm_set1_epi32(127), exponent);
+    // Denormalized: (mantissa | 0x800000) >> (-63 - exponent) == |f| * 2^85, zero below 2^-79
+    __m128 absf = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+    __m128i denormal = _mm_cvttps_epi32(_mm_mul_ps(absf, _mm_set1_ps(38685626227668133590597632.0f)));
+    denormal = _mm_andnot_si128(_mm_cmplt_epi32(biased, _mm_set1_epi32(49)), denormal);
+    mantissa = select(isSmall, denormal, mantissa);
+    exponent = _mm_andnot_si128(isSmall, exponent);
+
+    return _mm_or_si128(_mm_slli_epi32(_mm_or_si128(sign, exponent), 16),
+                        _mm_and_si128(_mm_srli_epi32(mantissa, 7), _mm_set1_epi32(0xffff)));
+}
+
+
+template <int bytesps> __m128i encodeSamples(__m128 f);
+template <> inline __m128i encodeSamples<2>(__m128 f) { return floatToHalf(f); }
+template <> inline __m128i encodeSamples<3>(__m128 f) { return floatToFP24(f); }
+template <> inline __m128i encodeSamples<4>(__m128 f) { return _mm_castps_si128(f); }
+
+
+// Encodes 16 samples at a time and scatters their bytes to the planes
+template <int bytesps> static size_t splitPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth) {
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16) {
+        __m128i v[4];
+        for (int i = 0; i < 4; ++i) {
+            v[i] = encodeSamples<bytesps>(_mm_loadu_ps(&src[col + 4*i]));
+        }
+        for (int plane = 0; plane < bytesps; ++plane) {
+            __m128i shift = _mm_cvtsi32_si128(8 * (bytesps - 1 - plane));
+            __m128i b[4];
+            for (int i = 0; i < 4; ++i) {
+                b[i] = _mm_and_si128(_mm_srl_epi32(v[i], shift), byteMask);
+            }
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3]));
+            _mm_storeu_si128((__m128i *)&dst[plane*tileWidth + col], bytes);
+        }
+    }
+    return col;
+}
+
+
+static size_t splitFloatPlanes(const float * src, uint8_t * dst, size_t width, size_t tileWidth, int bytesps) {
+    switch (bytesps) {
+        case 2: return splitPlanes<2>(src, dst, width, tileWidth);
+        case 3: return splitPlanes<3>(src, dst, width, tileWidth);
+        case 4: return splitPlanes<4>(src, dst, width, tileWidth);
+        default: return 0;
+    }
+}
+
+
+static void encodeDelta(uint8_t * buffer, size_t length) {
+    size_t i = 0;
+    __m128i prev = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *)&buffer[i]);
+        __m128i shifted = _mm_or_si128(_mm_slli_si128(v, 2), _mm_srli_si128(prev, 14));
+        _mm_storeu_si128((__m128i *)&buffer[i], _mm_sub_epi8(v, shifted));
+        prev = v;
+    }
+    uint16_t last = _mm_extract_epi16(prev, 7);
+    uint8_t before2 = last & 0xff, before1 = last >> 8; // Original values at i - 2 and i - 1
+    for (; i < length; ++i) {
+        uint8_t v = buffer[i];
+        buffer[i] = v - before2;
+        before2 = before1;
+        before1 = v;
+    }
+}
+
+
+static size_t fattenColumns(const uint8_t * const * rows, int radius, uint8_t * const * maxArray, size_t width) {
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i lmax = _mm_loadu_si128((__m128i*)&rows[0][x]);
+        if (radius < 2) // maxArray[0] is only used when radius < 2
+            _mm_storeu_si128((__m128i*)&maxArray[0][x], lmax);
+        for (int i = 1; i <= radius; i++) {
+            lmax = _mm_max_epu8(_mm_loadu_si128((__m128i*)&rows[i][x]), lmax);
+            lmax = _mm_max_epu8(_mm_loadu_si128((__m128i*)&rows[-i][x]), lmax);
+            _mm_storeu_si128((__m128i*)&maxArray[i][x], lmax);
+        }
+    }
+    return x;
+}
+
+
+static size_t fattenRow(const uint8_t * const * maxArray, const int * circ, int radius,
+                        uint8_t * result, size_t x, size_t width) {
+    for (; x + 16 + radius <= width; x += 16) {
+        __m128i lmax = _mm_loadu_si128((__m128i*)&maxArray[circ[radius]][x + radius]);
+        for (int i = radius - 1; i >= -radius; i--)
+            lmax = _mm_max_epu8(lmax, _mm_loadu_si128((__m128i*)&maxArray[circ[i]][x + i]));
+        _mm_storeu_si128((__m128i*)&result[x], lmax);
+    }
+    return x;
+}
+
+
+const SimdKernels kernels = {
+    splitFloatPlanes,
+    encodeDelta,
+    fattenColumns,
+    fattenRow,
+};
+
+} // namespace sse2
+
+} // namespace hdrmerge
+#endif
@@ -0,0 +1,109 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#include <string>
+#include <vector>
+#include "Threads.hpp"
+using namespace hdrmerge;
+
+#if defined(__linux__) && defined(_OPENMP)
+// The CPUs of the process before pin(), for the threads that are not part of the parallel loops
+static cpu_set_t processCpus;
+static bool pinned = false;
+#endif
+
+
+void Threads::setCount(int n) {
+#ifdef _OPENMP
+    if (n > 0) {
+        omp_set_num_threads(n);
+    }
+#endif
+}
+
+
+int Threads::count() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+
+bool Threads::pin() {
+#if defined(__linux__) && defined(_OPENMP)
+    if (!pinned && sched_getaffinity(0, sizeof(processCpus), &processCpus)) {
+        return false;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &processCpus)) {
+            cpus.push_back(cpu);
+        }
+    }
+    bool result = true;
+    // The workers of OpenMP persist between parallel regions, so they keep their CPU. So does
+    // the main thread, which is thread 0 of every parallel loop.
+    #pragma omp parallel reduction(&&:result)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+        result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+    pinned = true;
+    return result;
+#else
+    return false;
+#endif
+}
+
+
+void Threads::unpin() {
+#if defined(__linux__) && defined(_OPENMP)
+    if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(processCpus), &processCpus);
+    }
+#endif
+}
+
+
+int Threads::numaNodes() {
+#ifdef __linux__
+    int nodes = 0;
+    while (access(("/sys/devices/system/node/node" + std::to_string(nodes)).c_str(), F_OK) == 0) {
+        ++nodes;
+    }
+    return nodes > 0 ? nodes : 1;
+#else
+    return 1;
+#endif
+}
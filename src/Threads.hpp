@@ -0,0 +1,46 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _THREADS_HPP_
+#define _THREADS_HPP_
+
+namespace hdrmerge {
+
+/// Number and placement of the threads of the parallel loops.
+class Threads {
+public:
+    /// Limits the threads of the parallel loops, 0 uses the OpenMP default
+    static void setCount(int n);
+    static int count();
+    /// Binds each thread of the parallel loops to one of the CPUs of the process, in order.
+    /// Returns false if it is not supported.
+    static bool pin();
+    /// Lets the calling thread run on any CPU of the process again. Threads created by a pinned
+    /// thread inherit its CPU, so the helper threads call it first.
+    static void unpin();
+    /// Number of NUMA nodes of the system, 1 if unknown
+    static int numaNodes();
+};
+
+} // namespace hdrmerge
+
+#endif // _THREADS_HPP_
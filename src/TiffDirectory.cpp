@@ -38,6 +38,40 @@ void IFD::addEntry(uint16_t tag, uint16_t type, uint32_t count, const void * dat
 }
 
 
+void IFD::addEntries(const uint8_t * stream, size_t size) {
+    uint32_t offset;
+    uint16_t numEntries;
+    if (size < 8) return;
+    std::copy_n(&stream[4], 4, (uint8_t *)&offset);
+    if ((uint64_t)offset + 2 > size) return;
+    std::copy_n(&stream[offset], 2, (uint8_t *)&numEntries);
+    numEntries = std::min<uint64_t>(numEntries, (size - offset - 2) / 12);
+    const uint8_t * p = &stream[offset + 2];
+    for (uint16_t i = 0; i < numEntries; ++i, p += 12) {
+        DirEntry entry;
+        std::copy_n(p, 12, (uint8_t *)&entry);
+        if (entry.type == 13) { // IFD, an offset
+            entry.type = LONG;
+        }
+        if (entry.type < BYTE || entry.type > DOUBLE || entry.count > size) {
+            continue;
+        }
+        removeEntry(entry.tag);
+        if (entry.dataSize() <= 4) {
+            addEntry(entry.tag, entry.type, entry.count, &p[8]);
+        } else if ((uint64_t)entry.offset + entry.dataSize() <= size) {
+            addEntry(entry.tag, entry.type, entry.count, &stream[entry.offset]);
+        }
+    }
+}
+
+
+void IFD::removeEntry(uint16_t tag) {
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [tag] (const DirEntry & e) { return e.tag == tag; }),
+                  entries.end());
+}
+
+
 void IFD::setValue(DirEntry * entry, const void * data) {
     const uint8_t * castedData = reinterpret_cast<const uint8_t *>(data);
     size_t dataSize = entry->dataSize();
@@ -80,6 +80,10 @@ public:
     void addEntry(uint16_t tag, const std::string &str) {
         addEntry(tag, ASCII, str.length() + 1, str.c_str());
     }
+    /// Copies the entries of the first IFD of a TIFF stream, in the byte order of the host,
+    /// replacing the ones with the same tag. Offsets to other IFDs are kept unchanged.
+    void addEntries(const uint8_t * stream, size_t size);
+    void removeEntry(uint16_t tag);
     void write(uint8_t * buffer, size_t & pos, bool hasNext);
     size_t length() const;
 
@@ -0,0 +1,135 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _TILEDARRAY2D_HPP_
+#define _TILEDARRAY2D_HPP_
+
+#include <algorithm>
+#include "Array2D.hpp"
+
+namespace hdrmerge {
+
+/// A two-dimensional array stored in square tiles, each of them row-major, instead of
+/// row-major as a whole. Border tiles are padded. Vertical and 2D kernels read each
+/// tile as a contiguous block, instead of striding across whole image rows.
+template <typename T, size_t TileSize = 64>
+class TiledArray2D {
+public:
+    static const size_t tileSize = TileSize;
+
+    TiledArray2D() : TiledArray2D(0, 0) {}
+    TiledArray2D(size_t w, size_t h) {
+        resize(w, h);
+    }
+    /// Converts a row-major array, without its displacement
+    explicit TiledArray2D(const Array2D<T> & src) : TiledArray2D(src.getWidth(), src.getHeight()) {
+        #pragma omp parallel for
+        for (size_t y = 0; y < height; ++y) {
+            setRow(y, &src[y * width]);
+        }
+    }
+
+    void resize(size_t w, size_t h) {
+        width = w;
+        height = h;
+        tilesX = (w + TileSize - 1) / TileSize;
+        tilesY = (h + TileSize - 1) / TileSize;
+        data = Array2D<T>::allocate(tilesX * tilesY * TileSize * TileSize);
+    }
+    /// Copies the array back to a row-major one of the same size
+    void copyTo(Array2D<T> & dst) const {
+        #pragma omp parallel for
+        for (size_t y = 0; y < height; ++y) {
+            getRow(y, &dst[y * width]);
+        }
+    }
+
+    size_t getWidth() const {
+        return width;
+    }
+    size_t getHeight() const {
+        return height;
+    }
+    size_t getTilesX() const {
+        return tilesX;
+    }
+    size_t getTilesY() const {
+        return tilesY;
+    }
+
+    /// The TileSize values of tile column tx in row y, contiguous
+    T * tileRow(size_t tx, size_t y) {
+        return &data[((y / TileSize) * tilesX + tx) * TileSize * TileSize + (y % TileSize) * TileSize];
+    }
+    const T * tileRow(size_t tx, size_t y) const {
+        return &data[((y / TileSize) * tilesX + tx) * TileSize * TileSize + (y % TileSize) * TileSize];
+    }
+    T & operator()(size_t x, size_t y) {
+        return tileRow(x / TileSize, y)[x % TileSize];
+    }
+    const T & operator()(size_t x, size_t y) const {
+        return tileRow(x / TileSize, y)[x % TileSize];
+    }
+
+    /// Gathers row y into width contiguous values
+    void getRow(size_t y, T * dst) const {
+        for (size_t tx = 0; tx < tilesX; ++tx) {
+            size_t n = std::min(TileSize, width - tx * TileSize);
+            std::copy_n(tileRow(tx, y), n, dst + tx * TileSize);
+        }
+    }
+    /// Scatters width contiguous values into row y, the padding of the last tile is cleared
+    void setRow(size_t y, const T * src) {
+        for (size_t tx = 0; tx < tilesX; ++tx) {
+            size_t n = std::min(TileSize, width - tx * TileSize);
+            std::fill(std::copy_n(src + tx * TileSize, n, tileRow(tx, y)), tileRow(tx, y) + TileSize, T());
+        }
+    }
+
+    /// Calls f(tx, ty) for each tile, in parallel
+    template <typename F> void forEachTile(const F & f) const {
+        #pragma omp parallel for collapse(2) schedule(dynamic)
+        for (size_t ty = 0; ty < tilesY; ++ty) {
+            for (size_t tx = 0; tx < tilesX; ++tx) {
+                f(tx, ty);
+            }
+        }
+    }
+    /// Calls f(tx) for each column of tiles, in parallel, for kernels that walk down the columns
+    template <typename F> void forEachTileColumn(const F & f) const {
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t tx = 0; tx < tilesX; ++tx) {
+            f(tx);
+        }
+    }
+
+private:
+    typename Array2D<T>::Buffer data;
+    size_t width, height;
+    size_t tilesX, tilesY;
+};
+
+template <typename T, size_t TileSize> const size_t TiledArray2D<T, TileSize>::tileSize;
+
+} // namespace hdrmerge
+
+#endif // _TILEDARRAY2D_HPP_
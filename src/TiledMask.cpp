@@ -0,0 +1,163 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include "TiledMask.hpp"
+using namespace hdrmerge;
+using namespace std;
+
+const size_t TiledMask::tileSize;
+
+
+void TiledMask::resize(size_t w, size_t h) {
+    width = w;
+    height = h;
+    tilesX = (w + tileSize - 1) / tileSize;
+    tilesY = (h + tileSize - 1) / tileSize;
+    tiles.clear();
+    tiles.resize(tilesX * tilesY);
+    fill(0);
+}
+
+
+void TiledMask::fill(uint8_t value) {
+    // All the tiles share the same one
+    shared_ptr<Tile> uniform = make_shared<Tile>(value);
+    std::fill(tiles.begin(), tiles.end(), uniform);
+}
+
+
+TiledMask::Tile & TiledMask::getMutableTile(size_t tx, size_t ty) {
+    shared_ptr<Tile> & tile = tiles[ty * tilesX + tx];
+    if (tile.use_count() > 1) {
+        tile = make_shared<Tile>(*tile);
+    }
+    return *tile;
+}
+
+
+void TiledMask::set(size_t x, size_t y, uint8_t value) {
+    if ((*this)(x, y) == value) {
+        return;
+    }
+    Tile & tile = getMutableTile(x / tileSize, y / tileSize);
+    tile.reserve(value);
+    tile.put(x % tileSize, y % tileSize, value);
+}
+
+
+void TiledMask::setSpan(size_t y, size_t x0, size_t x1, uint8_t value) {
+    size_t ty = y / tileSize;
+    y %= tileSize;
+    while (x0 < x1) {
+        size_t tx = x0 / tileSize, end = min(x1, (tx + 1) * tileSize);
+        const Tile & current = *tiles[ty * tilesX + tx];
+        if (current.bits != 0 || current.value != value) {
+            Tile & tile = getMutableTile(tx, ty);
+            tile.reserve(value);
+            for (size_t x = x0; x < end; ++x) {
+                tile.put(x % tileSize, y, value);
+            }
+        }
+        x0 = end;
+    }
+}
+
+
+void TiledMask::Tile::repack(int newBits) {
+    Tile result(0);
+    result.bits = newBits;
+    result.words.resize(tileSize * newBits);
+    for (size_t y = 0; y < tileSize; ++y) {
+        for (size_t x = 0; x < tileSize; ++x) {
+            result.put(x, y, get(x, y));
+        }
+    }
+    *this = std::move(result);
+}
+
+
+void TiledMask::Tile::decodeRow(size_t y, size_t x, size_t n, uint8_t * dst) const {
+    if (bits == 0) {
+        std::fill_n(dst, n, value);
+        return;
+    }
+    const uint64_t * row = &words[y * bits];
+    uint8_t mask = (1 << bits) - 1;
+    for (size_t end = x + n; x < end; ++x) {
+        size_t bit = x * bits;
+        *dst++ = (row[bit / 64] >> (bit % 64)) & mask;
+    }
+}
+
+
+void TiledMask::getRow(size_t y, size_t x, size_t n, uint8_t * dst) const {
+    const shared_ptr<Tile> * tile = &tiles[(y / tileSize) * tilesX + x / tileSize];
+    y %= tileSize;
+    for (size_t end = x + n; x < end; ++tile) {
+        size_t count = min(end, (x / tileSize + 1) * tileSize) - x;
+        (*tile)->decodeRow(y, x % tileSize, count, dst);
+        dst += count;
+        x += count;
+    }
+}
+
+
+void TiledMask::setStrip(size_t ty, const uint8_t * rows) {
+    size_t numRows = min(tileSize, height - ty * tileSize);
+    for (size_t tx = 0; tx < tilesX; ++tx) {
+        size_t x0 = tx * tileSize, numCols = min(tileSize, width - x0);
+        uint8_t minValue = rows[x0], maxValue = rows[x0];
+        for (size_t y = 0; y < numRows; ++y) {
+            const uint8_t * row = rows + y * width + x0;
+            for (size_t x = 0; x < numCols; ++x) {
+                minValue = min(minValue, row[x]);
+                maxValue = max(maxValue, row[x]);
+            }
+        }
+        shared_ptr<Tile> tile = make_shared<Tile>(minValue);
+        if (minValue != maxValue) {
+            // The padding of border tiles keeps the minimum value
+            tile->repack(bitsFor(maxValue));
+            for (size_t y = 0; y < numRows; ++y) {
+                const uint8_t * row = rows + y * width + x0;
+                for (size_t x = 0; x < numCols; ++x) {
+                    tile->put(x, y, row[x]);
+                }
+            }
+        }
+        tiles[ty * tilesX + tx] = std::move(tile);
+    }
+}
+
+
+size_t TiledMask::memoryUsage() const {
+    size_t result = tiles.size() * sizeof(tiles[0]);
+    const Tile * last = nullptr;
+    for (auto & tile : tiles) {
+        if (tile.get() != last) {
+            result += sizeof(Tile) + tile->words.size() * sizeof(uint64_t);
+            last = tile.get();
+        }
+    }
+    return result;
+}
@@ -0,0 +1,114 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _TILEDMASK_HPP_
+#define _TILEDMASK_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace hdrmerge {
+
+/// A layer index per pixel, stored in square tiles. Tiles of a single value take no
+/// pixel data, the rest are bit-packed with as few bits as their values need. Copies
+/// share their tiles, which are only duplicated when one of the copies modifies them.
+class TiledMask {
+public:
+    static const size_t tileSize = 64;
+
+    TiledMask() : TiledMask(0, 0) {}
+    TiledMask(size_t w, size_t h) { resize(w, h); }
+
+    /// Resizes the mask, filled with zeroes
+    void resize(size_t w, size_t h);
+    void fill(uint8_t value);
+    size_t getWidth() const {
+        return width;
+    }
+    size_t getHeight() const {
+        return height;
+    }
+
+    uint8_t operator()(size_t x, size_t y) const {
+        return tiles[(y / tileSize) * tilesX + x / tileSize]->get(x % tileSize, y % tileSize);
+    }
+    void set(size_t x, size_t y, uint8_t value);
+    /// Sets the pixels from x0 to x1, excluded, of row y
+    void setSpan(size_t y, size_t x0, size_t x1, uint8_t value);
+    /// Decodes row y into dst, which holds getWidth() values
+    void getRow(size_t y, uint8_t * dst) const {
+        getRow(y, 0, width, dst);
+    }
+    /// Decodes n values of row y, starting at column x
+    void getRow(size_t y, size_t x, size_t n, uint8_t * dst) const;
+    /// Replaces the tiles of strip ty, from up to tileSize rows of getWidth() values.
+    /// Different strips can be set concurrently.
+    void setStrip(size_t ty, const uint8_t * rows);
+
+    /// Approximate size of the mask in bytes
+    size_t memoryUsage() const;
+
+private:
+    struct Tile {
+        int bits;      ///< Bits per value, 0 if all the values are equal
+        uint8_t value; ///< The value of a tile with zero bits
+        std::vector<uint64_t> words; ///< tileSize values per row, bits words per row
+
+        Tile(uint8_t v) : bits(0), value(v) {}
+        uint8_t get(size_t x, size_t y) const {
+            if (bits == 0) return value;
+            size_t bit = x * bits;
+            return (words[y * bits + bit / 64] >> (bit % 64)) & ((1 << bits) - 1);
+        }
+        void put(size_t x, size_t y, uint8_t v) {
+            size_t bit = x * bits;
+            uint64_t & word = words[y * bits + bit / 64];
+            uint64_t m = ((uint64_t(1) << bits) - 1) << (bit % 64);
+            word = (word & ~m) | (uint64_t(v) << (bit % 64));
+        }
+        void repack(int newBits);
+        /// Makes room for value, the tile must not be shared
+        void reserve(uint8_t v) {
+            if (bits == 0) {
+                if (v != value) repack(bitsFor(std::max(v, value)));
+            } else if (v >> bits) {
+                repack(bitsFor(v));
+            }
+        }
+        void decodeRow(size_t y, size_t x, size_t n, uint8_t * dst) const;
+    };
+
+    std::vector<std::shared_ptr<Tile>> tiles;
+    Tile & getMutableTile(size_t tx, size_t ty);
+    size_t width, height;
+    size_t tilesX, tilesY;
+
+    static int bitsFor(uint8_t value) {
+        return value < 2 ? 1 : value < 4 ? 2 : value < 16 ? 4 : 8;
+    }
+};
+
+} // namespace hdrmerge
+
+#endif // _TILEDMASK_HPP_
@@ -21,6 +21,8 @@
  */
 
 #include "../src/Array2D.hpp"
+#include "../src/BufferPool.hpp"
+#include "../src/TiledArray2D.hpp"
 #include <boost/test/unit_test.hpp>
 using namespace hdrmerge;
 using namespace std;
@@ -98,3 +100,51 @@ BOOST_FIXTURE_TEST_CASE(array2d_copy, Array2DFixture100x10) {
     BOOST_CHECK_NE(b(2, 3), 3.5);
     BOOST_CHECK_EQUAL(b(0, 0), 3.5);
 }
+
+
+BOOST_AUTO_TEST_CASE(array2d_aligned) {
+    Array2D<uint8_t> a(3, 5), b(1000, 1000);
+    BOOST_CHECK_EQUAL((uintptr_t)&a[0] % BufferAllocator::alignment, 0);
+    BOOST_CHECK_EQUAL((uintptr_t)&b[0] % BufferAllocator::alignment, 0);
+}
+
+
+BOOST_AUTO_TEST_CASE(array2d_pool) {
+    BufferPool pool(4 << 20);
+    BufferAllocator::set(&pool);
+    const float * first;
+    {
+        Array2D<float> a(500, 500);
+        first = &a[0];
+    }
+    BOOST_CHECK_GE(pool.retainedBytes(), 500 * 500 * sizeof(float));
+    // A slightly smaller buffer takes the same size class
+    Array2D<float> b(500, 499);
+    BOOST_CHECK_EQUAL(&b[0], first);
+    BOOST_CHECK_EQUAL(pool.retainedBytes(), 0);
+    {
+        // Over the cap
+        Array2D<float> c(1100, 1000);
+    }
+    BOOST_CHECK_EQUAL(pool.retainedBytes(), 0);
+    BOOST_CHECK_EQUAL(pool.getHits(), 1);
+    BufferAllocator::set(nullptr);
+}
+
+
+BOOST_AUTO_TEST_CASE(tiledarray2d_convert) {
+    Array2D<int> a(100, 70), b(100, 70);
+    for (size_t i = 0; i < a.size(); ++i) {
+        a[i] = i;
+    }
+    TiledArray2D<int, 16> t(a);
+    BOOST_CHECK_EQUAL(t.getTilesX(), 7);
+    BOOST_CHECK_EQUAL(t.getTilesY(), 5);
+    BOOST_CHECK_EQUAL(t(37, 51), a(37, 51));
+    BOOST_CHECK_EQUAL(t.tileRow(2, 51)[5], a(37, 51));
+    t(99, 69) = -1;
+    t.copyTo(b);
+    BOOST_CHECK_EQUAL(b(99, 69), -1);
+    BOOST_CHECK_EQUAL(b(98, 69), a(98, 69));
+    BOOST_CHECK_EQUAL(b(0, 0), 0);
+}
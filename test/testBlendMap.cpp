@@ -0,0 +1,86 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <memory>
+#include "../src/BlendMap.hpp"
+#include "../src/LoadSaveOptions.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+// A mask of three layers, with a disc of layer 2 crossing the right and bottom edges and
+// a band of layer 1 along the left edge
+static TiledMask syntheticMask(size_t width, size_t height) {
+    TiledMask mask(width, height);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            double dx = x - width * 0.8, dy = y - height * 0.9;
+            if (dx * dx + dy * dy < height * height * 0.16) {
+                mask.set(x, y, 2);
+            } else if (x < width / 5 + y / 4) {
+                mask.set(x, y, 1);
+            }
+        }
+    }
+    return mask;
+}
+
+
+BOOST_AUTO_TEST_CASE(testBlendMapFactors) {
+    // The factors of the default feather samples, with bounds just above the errors they give
+    // on this mask, in layer steps
+    struct Case {
+        int radius;
+        double maxError, meanError;
+    };
+    const int samples = SaveOptions().featherSamples;
+    for (const Case & c : {Case{16, 0.15, 0.005}, Case{24, 0.235, 0.0107},
+                           Case{32, 0.275, 0.0165}, Case{64, 0.255, 0.032}}) {
+        int factor = BlendMap::factorFor(c.radius, samples);
+        BOOST_REQUIRE_GT(factor, 1);
+        // The height and the second width are not multiples of any factor
+        for (size_t width : {480, 481}) {
+            size_t height = 323;
+            TiledMask mask = syntheticMask(width, height);
+            BlendMap full(mask, c.radius, 1), map(mask, c.radius, factor);
+            unique_ptr<float[]> fullBuffer(new float[width]), buffer(new float[width]);
+            double maxError = 0.0, sumError = 0.0;
+            for (size_t y = 0; y < height; ++y) {
+                const float * expected = full.getRow(y, fullBuffer.get());
+                const float * row = map.getRow(y, buffer.get());
+                for (size_t x = 0; x < width; ++x) {
+                    double error = std::abs(row[x] - expected[x]);
+                    maxError = std::max(maxError, error);
+                    sumError += error;
+                }
+                // The edges are clamped, not extrapolated, up to the rounding of the blur
+                BOOST_CHECK(row[0] > -1e-5f && row[0] < 2.0f + 1e-5f);
+                BOOST_CHECK(row[width - 1] > -1e-5f && row[width - 1] < 2.0f + 1e-5f);
+            }
+            BOOST_TEST_MESSAGE("Radius " << c.radius << ", factor " << factor << ", width " << width
+                << ": max error " << maxError << ", mean error " << sumError / (width * height));
+            BOOST_CHECK_LT(maxError, c.maxError);
+            BOOST_CHECK_LT(sumError / (width * height), c.meanError);
+        }
+    }
+}
@@ -22,8 +22,11 @@
 
 #include <string>
 #include <cmath>
+#include <chrono>
+#include <iostream>
 #include <QDir>
 #include "../src/BoxBlur.hpp"
+#include "../src/TiledArray2D.hpp"
 #include "SampleImage.hpp"
 #include "../src/Log.hpp"
 #include <boost/test/unit_test.hpp>
@@ -41,3 +44,46 @@ BOOST_AUTO_TEST_CASE(testBoxBlur) {
         result.save(fileName);
     }
 }
+
+
+BOOST_AUTO_TEST_CASE(testBoxBlurLayouts) {
+    Array2D<float> src(301, 203);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (i * 7919) % 101;
+    }
+    BoxBlur rows(src), tiles(src);
+    rows.blur(9, BoxBlur::ROWS);
+    tiles.blur(9, BoxBlur::TILES);
+    for (size_t i = 0; i < src.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(rows[i], tiles[i]);
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(benchBoxBlurLayouts) {
+    auto seconds = [] (chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    // 24, 45 and 100 megapixel sensors
+    for (auto size : {make_pair(6000, 4000), make_pair(8192, 5464), make_pair(11648, 8736)}) {
+        Array2D<float> src(size.first, size.second);
+        for (size_t i = 0; i < src.size(); ++i) {
+            src[i] = (i * 7919) % 101;
+        }
+        auto start = chrono::steady_clock::now();
+        TiledArray2D<float> tiled(src);
+        tiled.copyTo(src);
+        double convert = seconds(start);
+        for (size_t radius : {3, 32}) {
+            BoxBlur rows(src), tiles(src);
+            start = chrono::steady_clock::now();
+            rows.blur(radius, BoxBlur::ROWS);
+            double rowsTime = seconds(start);
+            start = chrono::steady_clock::now();
+            tiles.blur(radius, BoxBlur::TILES);
+            double tilesTime = seconds(start);
+            cout << size.first << 'x' << size.second << ", radius " << radius << ": rows " << rowsTime
+                << " s, tiles " << tilesTime << " s, of which conversion " << convert << " s" << endl;
+        }
+    }
+}
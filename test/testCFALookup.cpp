@@ -0,0 +1,54 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "../src/CFALookup.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+template <typename CFA> static void checkLookup(const RawParameters & params) {
+    CFA cfa(params);
+    for (int y = -6; y < 20; ++y) {
+        for (int x = -6; x < 20; ++x) {
+            const typename CFA::Row & row = cfa.row(y);
+            int c = CFA::column(x);
+            BOOST_CHECK_EQUAL(row.color[c], params.FC(x, y));
+            BOOST_CHECK_EQUAL(row.black[c], params.cblack[params.FC(x, y)]);
+            BOOST_CHECK_EQUAL(row.whiteMult[c], params.camMul[params.FC(x, y)]);
+        }
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(cfalookup_matches_pattern) {
+    RawParameters params;
+    for (int c = 0; c < 4; ++c) {
+        params.cblack[c] = 100 + c;
+        params.camMul[c] = 1.0f + c;
+    }
+    params.FC.setPattern(0x94949494, [](int, int) { return 0; });
+    checkLookup<BayerLookup>(params);
+    params.FC.setPattern(0x16161616 ^ 0x00ff0000, [](int, int) { return 0; });
+    checkLookup<Bayer8RowLookup>(params);
+    params.FC.setPattern(9, [](int row, int col) { return (row * 5 + col * 3) % 3; });
+    checkLookup<XTransLookup>(params);
+}
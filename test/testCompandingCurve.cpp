@@ -0,0 +1,61 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "../src/CompandingCurve.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+
+BOOST_AUTO_TEST_CASE(testCompandingCurveTable) {
+    CompandingCurve curve;
+    const vector<uint16_t> & table = curve.linearization();
+    BOOST_REQUIRE_LE(table.size(), 65536);
+    BOOST_CHECK_EQUAL(table.front(), 0);
+    BOOST_CHECK_EQUAL(table.back(), 65535);
+    BOOST_CHECK(is_sorted(table.begin(), table.end()));
+    for (int code = 0; code <= CompandingCurve::knee; ++code) {
+        BOOST_REQUIRE_EQUAL(table[code], code);
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(testCompandingCurveError) {
+    CompandingCurve curve;
+    double maxAbsError = 0.0, maxRelError = 0.0;
+    for (int i = 0; i <= 65535 * 4; ++i) {
+        float linear = i / 4.0f;
+        double error = std::abs(curve.decode(curve.encode(linear)) - linear);
+        maxAbsError = std::max(maxAbsError, linear < CompandingCurve::knee ? error : 0.0);
+        if (linear >= CompandingCurve::knee) {
+            maxRelError = std::max(maxRelError, error / linear);
+        }
+    }
+    cerr << "Companding curve with " << curve.linearization().size() << " codes: max. error "
+        << maxAbsError << " below the knee, " << maxRelError << " relative above it" << endl;
+    BOOST_CHECK_LE(maxAbsError, 0.5);
+    // Half the step, plus the rounding of the table
+    BOOST_CHECK_LE(maxRelError, 1.0 / (2 * CompandingCurve::knee) + 0.5 / CompandingCurve::knee);
+}
@@ -0,0 +1,69 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <random>
+#include "../src/CompressedFrame.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+static vector<uint16_t> randomFrame(size_t width, size_t height) {
+    mt19937 rng(1);
+    vector<uint16_t> pixels(width * height);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            // Smooth areas, noise and the extreme values
+            uint16_t v = y < 10 ? 1000 + x : rng();
+            pixels[y * width + x] = y == 20 ? (x & 1) * 65535 : v;
+        }
+    }
+    return pixels;
+}
+
+
+BOOST_AUTO_TEST_CASE(compressedframe_lossless) {
+    size_t width = 203, height = 45;
+    vector<uint16_t> pixels = randomFrame(width, height);
+    for (size_t cacheSize : { size_t(0), size_t(1) << 20 }) {
+        CompressedFrame::setCacheSize(cacheSize);
+        CompressedFrame frame(pixels.data(), width, height);
+        vector<uint16_t> decoded(width * height);
+        frame.decodeRows(0, height, decoded.data());
+        BOOST_CHECK(decoded == pixels);
+        // Rows that start and end in the middle of a strip
+        vector<uint16_t> rows(20 * width);
+        frame.decodeRows(7, 20, rows.data());
+        BOOST_CHECK(std::equal(rows.begin(), rows.end(), pixels.begin() + 7 * width));
+    }
+    CompressedFrame::setCacheSize(0);
+}
+
+
+BOOST_AUTO_TEST_CASE(compressedframe_size) {
+    size_t width = 256, height = 64;
+    vector<uint16_t> pixels(width * height);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = 2000 + (i % width) / 8;
+    }
+    CompressedFrame frame(pixels.data(), width, height);
+    BOOST_CHECK_LT(frame.memoryUsage(), pixels.size() * sizeof(uint16_t) / 4);
+}
@@ -22,10 +22,16 @@
 
 #include <string>
 #include <cmath>
+#include <chrono>
+#include <iostream>
 #include <QDir>
+#include <QFileInfo>
 #include "../src/ImageIO.hpp"
 #include "../src/Log.hpp"
 #include "../src/DngFloatWriter.hpp"
+#include "../src/BoxBlur.hpp"
+#include "../src/BufferAllocator.hpp"
+#include "../src/Threads.hpp"
 #include <boost/test/unit_test.hpp>
 using namespace hdrmerge;
 using namespace std;
@@ -58,3 +64,161 @@ BOOST_AUTO_TEST_CASE(testDngFloatWriter) {
 //         }
 //     }
 }
+
+
+BOOST_AUTO_TEST_CASE(binRawDataKeepsPhase) {
+    RawParameters params;
+    params.FC.setPattern(0x94949494, [](int, int) { return 0; });
+    params.rawWidth = 45;
+    params.rawHeight = 31;
+    params.leftMargin = 3;
+    params.topMargin = 2;
+    params.width = 41;
+    params.height = 28;
+    // Each color in its own range, with a ramp along the active area
+    Array2D<float> raw(params.rawWidth, params.rawHeight);
+    for (size_t y = 0; y < params.rawHeight; ++y) {
+        for (size_t x = 0; x < params.rawWidth; ++x) {
+            int ax = x - params.leftMargin, ay = y - params.topMargin;
+            raw(x, y) = 1000.0f * params.FC(ax, ay) + ax * 0.5f + ay * 0.25f;
+        }
+    }
+    const int factor = 3;
+    Array2D<float> binned = ImageIO::binRawData(raw, params, factor);
+    BOOST_REQUIRE_EQUAL(binned.getWidth(), 12);
+    BOOST_REQUIRE_EQUAL(binned.getHeight(), 8);
+    BOOST_CHECK_EQUAL(params.width, 12);
+    BOOST_CHECK_EQUAL(params.rawWidth, 12);
+    BOOST_CHECK_EQUAL(params.leftMargin, 0);
+    for (size_t y = 0; y < binned.getHeight(); ++y) {
+        for (size_t x = 0; x < binned.getWidth(); ++x) {
+            // The mean of the ramp over a block is its value at the block center
+            int cx = (x / 2) * 2 * factor + x % 2 + factor - 1;
+            int cy = (y / 2) * 2 * factor + y % 2 + factor - 1;
+            float expected = 1000.0f * params.FC(x, y) + cx * 0.5f + cy * 0.25f;
+            BOOST_CHECK_CLOSE(binned(x, y), expected, 1e-3);
+        }
+    }
+}
+
+
+namespace {
+struct SilentProgressIndicator : public ProgressIndicator {
+    virtual void advance(int percent, const char * message, const char * arg) {}
+};
+
+
+// Loads the sample images, as the benchmarks' input
+ImageStack & loadSamples(ImageIO & io, RawParameters & params) {
+    LoadOptions lo;
+    SilentProgressIndicator spi;
+    lo.fileNames = { "test/sample1.dng", "test/sample2.dng", "test/sample3.dng" };
+    BOOST_REQUIRE_EQUAL(io.load(lo, spi), 6);
+    ImageStack & stack = io.getImageStack();
+    params.fileName = lo.fileNames.back();
+    BOOST_REQUIRE(ImageIO::loadRawImage(params.fileName, params).good());
+    params.width = stack.getWidth();
+    params.height = stack.getHeight();
+    params.adjustWhite(stack.getImage(stack.size() - 1));
+    return stack;
+}
+
+// Merges the sample images
+Array2D<float> composeSamples(RawParameters & params) {
+    ImageIO io;
+    return loadSamples(io, params).compose(params, 3);
+}
+}
+
+
+BOOST_AUTO_TEST_CASE(benchDngCompressionLevels) {
+    RawParameters params;
+    Array2D<float> composed = composeSamples(params);
+
+    cout << "Deflate backend: " << DeflateCompressor::backendName() << endl;
+    for (int bps : {16, 24, 32}) {
+        double rawBytes = (double)composed.size() * (bps >> 3);
+        for (int level : {0, 1, 3, 6, 9}) {
+            DngFloatWriter writer;
+            writer.setBitsPerSample(bps);
+            writer.setCompressionLevel(level);
+            QString fileName = QDir::tempPath() + QString("/testDngLevel_%1_%2.dng").arg(bps).arg(level);
+            auto start = chrono::steady_clock::now();
+            writer.write(Array2D<float>(composed), params, fileName);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double fileBytes = QFileInfo(fileName).size();
+            BOOST_CHECK(fileBytes > 0);
+            cout << bps << " bps, level " << level << ": " << (rawBytes / seconds / 1048576.0) << " MB/s, ratio "
+                 << (rawBytes / fileBytes) << endl;
+        }
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(benchDngTileSizes) {
+    RawParameters params;
+    Array2D<float> composed = composeSamples(params);
+
+    const uint32_t sizes[][2] = {
+        { 0, 0 }, { 128, 128 }, { 256, 256 }, { 512, 512 }, { 1024, 1024 }, { 2048, 2048 }, { 4096, 256 }, { 256, 4096 }
+    };
+    for (int bps : {16, 32}) {
+        double rawBytes = (double)composed.size() * (bps >> 3);
+        for (auto & size : sizes) {
+            DngFloatWriter writer;
+            writer.setBitsPerSample(bps);
+            writer.setTileSize(size[0], size[1]);
+            QString fileName = QDir::tempPath() + QString("/testDngTiles_%1_%2x%3.dng").arg(bps).arg(size[0]).arg(size[1]);
+            auto start = chrono::steady_clock::now();
+            writer.write(Array2D<float>(composed), params, fileName);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double fileBytes = QFileInfo(fileName).size();
+            BOOST_CHECK(fileBytes > 0);
+            cout << bps << " bps, tiles " << size[0] << 'x' << size[1] << ": " << seconds << " s, "
+                 << (fileBytes / 1048576.0) << " MB, ratio " << (rawBytes / fileBytes) << endl;
+        }
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(benchHugePages) {
+    for (const char * policy : {"none", "transparent", "explicit"}) {
+        BOOST_REQUIRE(BufferAllocator::setHugePages(policy));
+        ImageIO io;
+        RawParameters params;
+        ImageStack & stack = loadSamples(io, params);
+        // Compose with a large radius, and blur a full frame on its own
+        auto start = chrono::steady_clock::now();
+        Array2D<float> composed = stack.compose(params, 32, 0);
+        double composeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        BoxBlur map(composed);
+        start = chrono::steady_clock::now();
+        map.blur(32);
+        double blurSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << policy << " huge pages: compose " << composeSeconds << " s, blur " << blurSeconds << " s" << endl;
+    }
+    BufferAllocator::setHugePages("transparent");
+}
+
+
+BOOST_AUTO_TEST_CASE(benchThreadScaling) {
+    int maxThreads = Threads::count();
+    for (bool firstTouch : {false, true}) {
+        BufferAllocator::setFirstTouch(firstTouch);
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            Threads::setCount(threads);
+            ImageIO io;
+            RawParameters params;
+            auto start = chrono::steady_clock::now();
+            ImageStack & stack = loadSamples(io, params);
+            double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            Array2D<float> composed = stack.compose(params, 32, 0);
+            double composeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << threads << " threads, first touch " << (firstTouch ? "on" : "off") << ": load "
+                << loadSeconds << " s, compose " << composeSeconds << " s" << endl;
+        }
+    }
+    Threads::setCount(maxThreads);
+    BufferAllocator::setFirstTouch(Threads::numaNodes() > 1);
+}
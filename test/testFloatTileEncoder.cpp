@@ -0,0 +1,130 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include <random>
+#include <vector>
+#include <limits>
+#include "../src/CpuFeatures.hpp"
+#include "../src/FloatTileEncoder.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+
+// The scalar, in-place encoder that DngFloatWriter used before
+static void referenceCompressFloats(uint8_t * dst, int tileWidth, int bytesps) {
+    if (bytesps == 2) {
+        uint16_t * dst16 = (uint16_t *) dst;
+        uint32_t * dst32 = (uint32_t *) dst;
+        for (int i = 0; i < tileWidth; ++i) {
+            dst16[i] = DNG_FloatToHalf(dst32[i]);
+        }
+    } else if (bytesps == 3) {
+        uint8_t  * dst8  = (uint8_t *)  dst;
+        uint32_t * dst32 = (uint32_t *) dst;
+        for (int i = 0; i < tileWidth; ++i) {
+            DNG_FloatToFP24(dst32[i], dst8);
+            dst8 += 3;
+        }
+    }
+}
+
+
+static void referenceEncodeFPDeltaRow(uint8_t * src, uint8_t * dst, size_t tileWidth, size_t realTileWidth, int bytesps, int factor) {
+    if (bytesps == 3) {
+        for (size_t col = 0; col < tileWidth; ++col) {
+            dst[col] = src[col*3];
+            dst[col + realTileWidth] = src[col*3 + 1];
+            dst[col + realTileWidth*2] = src[col*3 + 2];
+        }
+    } else {
+        for (size_t col = 0; col < tileWidth; ++col) {
+            for (int byte = 0; byte < bytesps; ++byte)
+                dst[col + realTileWidth*(bytesps-byte-1)] = src[col*bytesps + byte];
+        }
+    }
+    for (int col = realTileWidth*bytesps - 1; col >= factor; --col) {
+        dst[col] -= dst[col - factor];
+    }
+}
+
+
+static vector<float> testSamples(size_t count) {
+    // Special values first, then a mix of ranges
+    vector<float> result = {
+        0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65520.0f, 1e10f, -1e10f,
+        numeric_limits<float>::infinity(), -numeric_limits<float>::infinity(),
+        numeric_limits<float>::quiet_NaN(), numeric_limits<float>::denorm_min(),
+        numeric_limits<float>::min(), numeric_limits<float>::max(),
+        6.1035156e-05f, 6.0975552e-05f, 5.9604645e-08f, 2.9802322e-08f, 2.9802326e-08f,
+        1.0009765625f, 1.00048828125f, 1.00146484375f, 2049.0f, 4097.0f,
+        1e-19f, 1e-20f, 1e-24f, 1e-25f, 1e19f, 1e20f
+    };
+    const uint32_t bitPatterns[] = {
+        0x7f800001, 0x7fffffff, 0xffc00000, 0x7f807fff, 0x7fffff80, 0x7fffff7f, 0x387fe000, 0x33000000, 0x32ffffff
+    };
+    for (uint32_t bits : bitPatterns) {
+        float f;
+        memcpy(&f, &bits, 4);
+        result.push_back(f);
+    }
+    mt19937 gen(1234);
+    uniform_real_distribution<float> linear(0.0f, 65535.0f);
+    uniform_int_distribution<uint32_t> anyBits;
+    while (result.size() < count) {
+        if (result.size() & 1) {
+            result.push_back(linear(gen));
+        } else {
+            uint32_t bits = anyBits(gen);
+            float f;
+            memcpy(&f, &bits, 4);
+            result.push_back(f);
+        }
+    }
+    return result;
+}
+
+
+BOOST_AUTO_TEST_CASE(float_tile_encoder_matches_reference) {
+    vector<float> samples = testSamples(4096);
+    // Every instruction set must produce the same output
+    for (int level = CpuFeatures::GENERIC; level <= CpuFeatures::detected(); ++level) {
+        CpuFeatures::setMaximum(CpuFeatures::name((CpuFeatures::Level)level));
+        for (int bytesps : {2, 3, 4}) {
+            for (size_t width : {1, 2, 15, 16, 17, 33, 64, 79, 100, 256, 1000}) {
+                for (size_t tileWidth : {width, width + 5, (width + 15) & ~(size_t)15}) {
+                    size_t offset = (width * 7 + bytesps) % (samples.size() - width);
+                    vector<uint8_t> expected(tileWidth * bytesps, 0), actual(tileWidth * bytesps, 0xaa);
+                    vector<float> src(&samples[offset], &samples[offset + width]), copy(src);
+                    referenceCompressFloats((uint8_t *)copy.data(), width, bytesps);
+                    referenceEncodeFPDeltaRow((uint8_t *)copy.data(), expected.data(), width, tileWidth, bytesps, 2);
+                    encodeFloatRow(src.data(), actual.data(), width, tileWidth, bytesps);
+                    BOOST_REQUIRE_MESSAGE(expected == actual, "Mismatch with " << bytesps << " bytes, width " << width
+                        << ", tile width " << tileWidth << ", " << CpuFeatures::name(CpuFeatures::current()) << " kernels");
+                    BOOST_CHECK(memcmp(src.data(), &samples[offset], width * sizeof(float)) == 0);
+                }
+            }
+        }
+    }
+    CpuFeatures::setMaximum(CpuFeatures::name(CpuFeatures::detected()));
+}
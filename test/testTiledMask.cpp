@@ -0,0 +1,214 @@
+/*
+ *  HDRMerge - HDR exposure merging software.
+ *  Copyright 2012 Javier Celaya
+ *  jcelaya@gmail.com
+ *
+ *  This file is part of HDRMerge.
+ *
+ *  HDRMerge is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  HDRMerge is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with HDRMerge. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include "../src/EditableMask.hpp"
+#include "../src/TiledMask.hpp"
+#include <boost/test/unit_test.hpp>
+using namespace hdrmerge;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(tiledmask_set) {
+    TiledMask m(150, 70);
+    BOOST_CHECK_EQUAL(m(149, 69), 0);
+    m.set(3, 5, 1);
+    m.set(140, 65, 7);
+    m.set(140, 66, 200);
+    BOOST_CHECK_EQUAL(m(3, 5), 1);
+    BOOST_CHECK_EQUAL(m(140, 65), 7);
+    BOOST_CHECK_EQUAL(m(140, 66), 200);
+    BOOST_CHECK_EQUAL(m(141, 65), 0);
+    BOOST_CHECK_EQUAL(m(4, 5), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tiledmask_strips) {
+    TiledMask m(150, 70);
+    vector<uint8_t> rows(150 * TiledMask::tileSize);
+    for (size_t s = 0; s < 2; ++s) {
+        for (size_t y = 0; y < TiledMask::tileSize; ++y) {
+            for (size_t x = 0; x < 150; ++x) {
+                // Uniform first tile, then 1, 2 and 3 layers
+                rows[y * 150 + x] = x < 64 ? 2 : (x + y + s * TiledMask::tileSize) % (x < 128 ? 2 : 3);
+            }
+        }
+        m.setStrip(s, rows.data());
+    }
+    vector<uint8_t> row(150);
+    for (size_t y = 0; y < 70; ++y) {
+        m.getRow(y, row.data());
+        for (size_t x = 0; x < 150; ++x) {
+            uint8_t expected = x < 64 ? 2 : (x + y) % (x < 128 ? 2 : 3);
+            BOOST_REQUIRE_EQUAL(row[x], expected);
+            BOOST_REQUIRE_EQUAL(m(x, y), expected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(tiledmask_copy_on_write) {
+    TiledMask m(200, 200);
+    m.fill(1);
+    TiledMask orig = m;
+    size_t shared = m.memoryUsage();
+    m.set(10, 10, 0);
+    m.set(100, 150, 3);
+    BOOST_CHECK_EQUAL(m(10, 10), 0);
+    BOOST_CHECK_EQUAL(m(100, 150), 3);
+    BOOST_CHECK_EQUAL(orig(10, 10), 1);
+    BOOST_CHECK_EQUAL(orig(100, 150), 1);
+    BOOST_CHECK_EQUAL(orig.memoryUsage(), shared);
+    BOOST_CHECK_GT(m.memoryUsage(), shared);
+}
+
+BOOST_AUTO_TEST_CASE(tiledmask_spans) {
+    TiledMask m(200, 10);
+    m.setSpan(3, 60, 130, 2);
+    m.setSpan(3, 100, 110, 0);
+    vector<uint8_t> row(80);
+    m.getRow(3, 50, 80, row.data());
+    for (size_t x = 50; x < 130; ++x) {
+        uint8_t expected = x < 60 || (x >= 100 && x < 110) ? 0 : 2;
+        BOOST_REQUIRE_EQUAL(row[x - 50], expected);
+    }
+    BOOST_CHECK_EQUAL(m(59, 3), 0);
+    BOOST_CHECK_EQUAL(m(130, 3), 0);
+    BOOST_CHECK_EQUAL(m(60, 2), 0);
+}
+
+
+// An editable mask where a layer is valid at an irregular set of pixels
+struct TestEditableMask : public EditableMask {
+    static bool isValid(int layer, int x, int y) {
+        return (layer * 7 + x * 3 + y * 5) % 11 != 0;
+    }
+    bool isLayerValidAt(int layer, int x, int y) const override {
+        return isValid(layer, x, y);
+    }
+};
+
+// The per-pixel brush that the spans of EditableMask replace
+static void brush(vector<uint8_t> & mask, int width, int height, int oldLayer, int newLayer,
+                  int x, int y, int radius) {
+    for (int row = std::max(y - radius, 0); row < std::min(y + radius + 1, height); ++row) {
+        for (int col = std::max(x - radius, 0); col < std::min(x + radius + 1, width); ++col) {
+            uint8_t & layer = mask[row * width + col];
+            if ((row - y) * (row - y) + (col - x) * (col - x) <= radius * radius &&
+                layer == oldLayer && TestEditableMask::isValid(newLayer, col, row)) {
+                layer = newLayer;
+            }
+        }
+    }
+}
+
+static void checkMask(const TiledMask & m, const vector<uint8_t> & expected) {
+    int width = m.getWidth(), height = m.getHeight();
+    vector<uint8_t> row(width);
+    for (int y = 0; y < height; ++y) {
+        m.getRow(y, row.data());
+        BOOST_REQUIRE(std::equal(row.begin(), row.end(), expected.begin() + y * width));
+    }
+}
+
+// The rectangle that undo and redo return covers the pixels that changed
+static void checkRect(const QRect & r, const vector<uint8_t> & a, const vector<uint8_t> & b, int width) {
+    int left = width, right = -1, top = -1, bottom = -1;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] != b[i]) {
+            int x = i % width, y = i / width;
+            left = std::min(left, x);
+            right = std::max(right, x);
+            if (top < 0) top = y;
+            bottom = y;
+        }
+    }
+    if (right < 0) {
+        BOOST_CHECK_EQUAL(r.width(), 0);
+    } else {
+        BOOST_CHECK_EQUAL(r.left(), left);
+        BOOST_CHECK_EQUAL(r.top(), top);
+        BOOST_CHECK_EQUAL(r.left() + r.width() - 1, right);
+        BOOST_CHECK_EQUAL(r.top() + r.height() - 1, bottom);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(editablemask_brush) {
+    const int width = 150, height = 90;
+    mt19937 rng(7);
+    TestEditableMask m;
+    m.resize(width, height);
+    vector<uint8_t> expected(width * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            // Areas of a single layer, with some noise
+            uint8_t layer = (x / 40 + y / 30) % 4;
+            if (rng() % 8 == 0) layer = rng() % 4;
+            m.set(x, y, layer);
+            expected[y * width + x] = layer;
+        }
+    }
+    // The state before each action and after the last one
+    vector<vector<uint8_t>> states(1, expected);
+    for (int action = 0; action < 30; ++action) {
+        if (action == 20) {
+            // Undo a few actions, so that the next one discards them
+            for (int i = 0; i < 5; ++i) {
+                BOOST_REQUIRE(m.canUndo());
+                m.undo();
+                states.pop_back();
+            }
+            expected = states.back();
+            checkMask(m, expected);
+        }
+        bool add = rng() % 2;
+        int layer = rng() % 3;
+        m.startAction(add, layer);
+        int oldLayer = add ? layer + 1 : layer, newLayer = add ? layer : layer + 1;
+        for (int stroke = 0; stroke < 6; ++stroke) {
+            // Centers beyond the edges too, and overlapping strokes
+            int x = int(rng() % (width + 40)) - 20, y = int(rng() % (height + 40)) - 20, r = rng() % 15;
+            m.editPixels(x, y, r);
+            brush(expected, width, height, oldLayer, newLayer, x, y, r);
+            m.editPixels(x + 3, y + 1, r);
+            brush(expected, width, height, oldLayer, newLayer, x + 3, y + 1, r);
+        }
+        // A drag of the smallest brush along a row, each span continues the previous one
+        int y = rng() % height;
+        for (int x = -2; x < width + 2; ++x) {
+            m.editPixels(x, y, 0);
+            brush(expected, width, height, oldLayer, newLayer, x, y, 0);
+        }
+        checkMask(m, expected);
+        states.push_back(expected);
+    }
+    BOOST_CHECK(!m.canRedo());
+    for (size_t i = states.size() - 1; i > 0; --i) {
+        BOOST_REQUIRE(m.canUndo());
+        checkRect(m.undo(), states[i], states[i - 1], width);
+        checkMask(m, states[i - 1]);
+    }
+    BOOST_CHECK(!m.canUndo());
+    for (size_t i = 1; i < states.size(); ++i) {
+        BOOST_REQUIRE(m.canRedo());
+        checkRect(m.redo(), states[i - 1], states[i], width);
+        checkMask(m, states[i]);
+    }
+}